@@ -0,0 +1,235 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <thread>
+#include "arena.hpp"
+
+namespace rtstat {
+
+static const size_t BLOCK_ALIGN = 64; // cache line
+static const int MPOL_BIND_MODE = 2; // MPOL_BIND of linux/mempolicy.h, libnuma is not required
+
+// parse cpulist like "0-3,8-11"
+static std::vector<int> parseCpuList(const char* list)
+{
+    std::vector<int> cpus;
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu=first; cpu<=last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        while (*p == ',' || *p == '\n' || *p == ' ') {
+            ++p;
+        }
+    }
+    return cpus;
+}
+
+NumaTopology::NumaTopology()
+{
+    for (int node=0; ; ++node) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* f = fopen(path, "r");
+        if (!f) {
+            break;
+        }
+        char list[4096] = {0};
+        if (fgets(list, sizeof(list), f)) {
+            std::vector<int> cpus = parseCpuList(list);
+            if (!cpus.empty()) { // memory-only nodes are skipped
+                cpus_.push_back(cpus);
+            }
+        }
+        fclose(f);
+    }
+    if (cpus_.empty()) {
+        std::vector<int> cpus;
+        for (unsigned cpu=0; cpu<std::max(std::thread::hardware_concurrency(), 1u); ++cpu) {
+            cpus.push_back(cpu);
+        }
+        cpus_.push_back(cpus);
+    }
+}
+
+bool NumaTopology::pin(size_t node) const
+{
+    if (node >= cpus_.size()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto it=cpus_[node].begin(); it!=cpus_[node].end(); ++it) {
+        CPU_SET(*it, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+Arena::Arena(int node, size_t regionSize)
+    : node_(node), regionSize_((regionSize + HUGE_PAGE_SIZE - 1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE), 
+    head_(NULL), end_(NULL), used_(0)
+{
+    if (!regionSize_) {
+        regionSize_ = HUGE_PAGE_SIZE;
+    }
+    // binding has effect on multi-node machines only
+    bind_ = (node_ >= 0) && (NumaTopology().nodes() > 1);
+}
+
+Arena::~Arena()
+{
+    for (auto it=regions_.begin(); it!=regions_.end(); ++it) {
+        munmap(it->base, it->size);
+    }
+}
+
+bool Arena::map(size_t size)
+{
+    size = (size + HUGE_PAGE_SIZE - 1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE;
+    bool huge = true;
+    void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (base == MAP_FAILED) {
+        // no reserved huge pages: 2 MB aligned region with transparent huge pages advice
+        huge = false;
+        char* raw = static_cast<char*>(mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw == MAP_FAILED) {
+            return false;
+        }
+        char* aligned = raw + (HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(raw) % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+        if (aligned > raw) {
+            munmap(raw, aligned - raw);
+        }
+        munmap(aligned + size, raw + size + HUGE_PAGE_SIZE - aligned - size);
+        base = aligned;
+#ifdef MADV_HUGEPAGE
+        madvise(base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    bool bound = false;
+#ifdef SYS_mbind
+    if (bind_) {
+        // pages are not touched yet, so they are allocated on node at first access
+        std::vector<unsigned long> mask(node_/(8*sizeof(unsigned long)) + 1, 0);
+        mask[node_/(8*sizeof(unsigned long))] |= 1ul << (node_ % (8*sizeof(unsigned long)));
+        bound = syscall(SYS_mbind, base, size, MPOL_BIND_MODE, mask.data(), mask.size()*8*sizeof(unsigned long) + 1, 0) == 0;
+    }
+#endif
+    regions_.push_back(Region(static_cast<char*>(base), size, huge, bound));
+    head_ = static_cast<char*>(base);
+    end_ = head_ + size;
+    return true;
+}
+
+void* Arena::allocate(size_t size)
+{
+    size = (size + BLOCK_ALIGN - 1)/BLOCK_ALIGN*BLOCK_ALIGN;
+    std::lock_guard<std::mutex> guard(lock_);
+    auto found = free_.find(size);
+    if ((found != free_.end()) && !found->second.empty()) {
+        void* p = found->second.back();
+        found->second.pop_back();
+        used_ += size;
+        return p;
+    }
+    if (static_cast<size_t>(end_ - head_) < size) {
+        // the rest of the last region is lost, blocks larger than region get own region
+        if (!map(std::max(size, regionSize_))) {
+            return NULL;
+        }
+    }
+    void* p = head_;
+    head_ += size;
+    used_ += size;
+    return p;
+}
+
+void Arena::deallocate(void* p, size_t size)
+{
+    if (!p) {
+        return;
+    }
+    size = (size + BLOCK_ALIGN - 1)/BLOCK_ALIGN*BLOCK_ALIGN;
+    std::lock_guard<std::mutex> guard(lock_);
+    free_[size].push_back(p);
+    used_ -= size;
+}
+
+size_t Arena::regions() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return regions_.size();
+}
+
+size_t Arena::hugeRegions() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t count = 0;
+    for (auto it=regions_.begin(); it!=regions_.end(); ++it) {
+        count += it->huge;
+    }
+    return count;
+}
+
+size_t Arena::bound() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t count = 0;
+    for (auto it=regions_.begin(); it!=regions_.end(); ++it) {
+        count += it->bound;
+    }
+    return count;
+}
+
+size_t Arena::used() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return used_;
+}
+
+}
@@ -0,0 +1,198 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace rtstat
+{
+
+// NUMA nodes and their CPUs from /sys/devices/system/node, single node with all CPUs if it is not available
+class NumaTopology
+{
+    public:
+        NumaTopology();
+
+        size_t nodes() const { return cpus_.size(); };
+        const std::vector<int>& cpus(size_t node) const { return cpus_[node]; };
+        bool pin(size_t node) const; // pin calling thread to CPUs of node, return false on failure
+
+    private:
+        std::vector<std::vector<int> > cpus_;
+};
+
+// Bump allocator of estimator state from 2 MB huge page regions bound to NUMA node.
+//    Region is mapped with MAP_HUGETLB, with transparent huge pages advice if no huge pages are reserved,
+//    it is bound to node with mbind() on multi-node machines only. Freed blocks are reused by exact size,
+//    regions are unmapped by destructor, so memory allocated from arena must not outlive it.
+class Arena
+{
+    public:
+        static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+        explicit Arena(int node = -1, size_t regionSize = 32 << 20); // node -1 - no binding
+        ~Arena();
+
+        void* allocate(size_t size); // 64 bytes aligned, return NULL if memory can't be mapped
+        void deallocate(void* p, size_t size);
+
+        int node() const { return node_; };
+        size_t regions() const;
+        size_t hugeRegions() const; // regions mapped with MAP_HUGETLB
+        size_t bound() const; // regions bound to node
+        size_t used() const; // bytes allocated and not freed
+
+    private:
+        class Region {
+            public:
+                Region(char* base, size_t size, bool huge, bool bound): base(base), size(size), huge(huge), bound(bound) {};
+
+                char* base;
+                size_t size;
+                bool huge;
+                bool bound;
+        };
+
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        bool map(size_t size);
+
+        int node_;
+        size_t regionSize_;
+        bool bind_;
+        mutable std::mutex lock_;
+        std::vector<Region> regions_;
+        char* head_; // free space of the last region
+        char* end_;
+        size_t used_;
+        std::map<size_t, std::vector<void*> > free_; // freed blocks by size
+};
+
+// Array of trivially copyable values in arena, default heap if arena is NULL.
+//    Arena is not kept in array: owner of several arrays keeps single Arena* and passes it to calls
+//    which allocate or free storage (vector with stateful allocator keeps a copy of it per vector).
+//    Array holds up to 2^32 - 1 values and is not copyable, owner must release() it with its arena.
+template <typename T> class ArenaArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "arena array values must be trivially copyable");
+
+    public:
+        ArenaArray(): data_(NULL), size_(0), capacity_(0) {};
+
+        inline T* data() { return data_; };
+        inline const T* data() const { return data_; };
+        inline T* begin() { return data_; };
+        inline const T* begin() const { return data_; };
+        inline T* end() { return data_ + size_; };
+        inline const T* end() const { return data_ + size_; };
+        inline T& operator[](size_t i) { return data_[i]; };
+        inline const T& operator[](size_t i) const { return data_[i]; };
+        inline size_t size() const { return size_; };
+        inline size_t capacity() const { return capacity_; };
+
+        void clear() { size_ = 0; };
+        void swap(ArenaArray& other) {
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            std::swap(capacity_, other.capacity_);
+        };
+        void reserve(size_t capacity, Arena* arena) {
+            if (capacity <= capacity_) {
+                return;
+            }
+            if (capacity > UINT32_MAX) {
+                throw std::bad_alloc();
+            }
+            T* data = allocate(capacity, arena);
+            std::copy(data_, data_ + size_, data);
+            deallocate(arena);
+            data_ = data;
+            capacity_ = static_cast<uint32_t>(capacity);
+        };
+        void resize(size_t size, Arena* arena, const T& value = T()) {
+            reserve(size, arena);
+            if (size > size_) {
+                std::fill(data_ + size_, data_ + size, value);
+            }
+            size_ = static_cast<uint32_t>(size);
+        };
+        void assign(const T* first, const T* last, Arena* arena) {
+            clear();
+            reserve(last - first, arena);
+            size_ = static_cast<uint32_t>(std::copy(first, last, data_) - data_);
+        };
+        void push_back(const T& value, Arena* arena) {
+            if (size_ == capacity_) {
+                reserve(capacity_ ? 2*static_cast<size_t>(capacity_) : 16, arena);
+            }
+            data_[size_++] = value;
+        };
+        void release(Arena* arena) { // free storage allocated from arena
+            deallocate(arena);
+            data_ = NULL;
+            size_ = 0;
+            capacity_ = 0;
+        };
+
+    private:
+        ArenaArray(const ArenaArray&);
+        ArenaArray& operator=(const ArenaArray&);
+
+        static T* allocate(size_t n, Arena* arena) {
+            if (!arena) {
+                return static_cast<T*>(::operator new(n*sizeof(T)));
+            }
+            void* p = arena->allocate(n*sizeof(T));
+            if (!p) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(p);
+        };
+        void deallocate(Arena* arena) {
+            if (!data_) {
+                return;
+            }
+            if (arena) {
+                arena->deallocate(data_, capacity_*sizeof(T));
+            }
+            else {
+                ::operator delete(data_);
+            }
+        };
+
+        T* data_;
+        uint32_t size_;
+        uint32_t capacity_;
+};
+
+} // namespace rtstat
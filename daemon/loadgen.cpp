@@ -0,0 +1,266 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "tdigest.hpp"
+#include "message.hpp"
+
+#define DIGEST_VARIANTS 16
+
+static int connectTo(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd >= 0) && (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const std::string& data)
+{
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t sent = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        offset += sent;
+    }
+    return true;
+}
+
+static bool receiveMessage(int fd, std::string& buffer, rtstat::Message& message)
+{
+    while (true) {
+        bool malformed;
+        size_t size = rtstat::Message::decode(buffer.data(), buffer.size(), message, &malformed);
+        if (size) {
+            buffer.erase(0, size);
+            return true;
+        }
+        if (malformed) {
+            return false;
+        }
+        char chunk[4096];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            return false;
+        }
+        buffer.append(chunk, received);
+    }
+}
+
+static std::string keyName(size_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "metric.%zu", key);
+    return name;
+}
+
+// sends digests (or raw values batches) of keys round-robin, then queries every key
+static void runClient(const char* path, size_t client, size_t messages, size_t keys, size_t batch, bool raw, double* weight)
+{
+    int fd = connectTo(path);
+    if (fd < 0) {
+        perror("connect");
+        return;
+    }
+
+    // a few pre-built payloads, so the client measures the daemon rather than its own T-digests
+    std::default_random_engine generator(client + 1);
+    std::normal_distribution<double> norm(60.0, 10.0);
+    std::vector<std::vector<double> > batches(DIGEST_VARIANTS, std::vector<double>(batch));
+    std::vector<rtstat::TDigest> digests(DIGEST_VARIANTS, rtstat::TDigest(100, 100));
+    for (size_t i=0; i<DIGEST_VARIANTS; ++i) {
+        std::generate(batches[i].begin(), batches[i].end(), [&norm, &generator]() { return norm(generator); } );
+        digests[i].add(batches[i].data(), batch);
+        digests[i].flush();
+    }
+
+    std::string out;
+    rtstat::Message message;
+    for (size_t i=0; i<messages; ++i) {
+        if (raw) {
+            message.type = rtstat::Message::Values;
+            message.key = keyName(i % keys);
+            message.values = batches[i % DIGEST_VARIANTS];
+        }
+        else {
+            message.setDigest(keyName(i % keys), digests[i % DIGEST_VARIANTS].view());
+        }
+        message.encode(out);
+        if ((out.size() > 256*1024) && !sendAll(fd, out)) {
+            perror("send");
+            close(fd);
+            return;
+        }
+        if (out.size() > 256*1024) {
+            out.clear();
+        }
+    }
+
+    double q[] = {0.5, 0.99};
+    message.type = rtstat::Message::Query;
+    message.values.assign(q, q + 2);
+    for (size_t key=0; key<keys; ++key) {
+        message.key = keyName(key);
+        message.encode(out);
+    }
+    sendAll(fd, out);
+
+    std::string buffer;
+    *weight = 0;
+    for (size_t key=0; key<keys; ++key) {
+        if (!receiveMessage(fd, buffer, message)) {
+            fprintf(stderr, "client %zu: no reply\n", client);
+            break;
+        }
+        *weight += message.values[0];
+    }
+    close(fd);
+}
+
+// invalid digests must be dropped without effect on the key, frame of broken layout must close the connection
+static bool runMalformed(const char* path)
+{
+    int fd = connectTo(path);
+    if (fd < 0) {
+        perror("connect");
+        return false;
+    }
+
+    std::vector<rtstat::TDigest::WeightedPoint> centroids(200);
+    for (size_t i=0; i<centroids.size(); ++i) {
+        centroids[i].set(i, 1.0);
+    }
+    rtstat::TDigest::View views[] = {
+        rtstat::TDigest::View(centroids.data(), 200, 0.0, 199.0, 1.0), // total weight below sum of weights
+        rtstat::TDigest::View(centroids.data(), 200, 199.0, 0.0, 200.0), // min > max
+    };
+    std::string out;
+    rtstat::Message message;
+    for (size_t i=0; i<sizeof(views)/sizeof(views[0]); ++i) {
+        message.setDigest("malformed", views[i]);
+        message.encode(out);
+    }
+    message.setDigest("malformed", rtstat::TDigest::View(centroids.data(), 200, 0.0, 199.0, 200.0));
+    message.values[3 + 2*10] = -1.0; // descending values
+    message.encode(out);
+    message.values[3 + 2*10] = 10.0;
+    message.values[4 + 2*20] = 0.0; // zero weight
+    message.encode(out);
+    message.values[4 + 2*20] = 1.0;
+    message.values[3 + 2*30] = NAN;
+    message.encode(out);
+
+    double q[] = {0.5};
+    message.type = rtstat::Message::Query;
+    message.values.assign(q, q + 1);
+    message.encode(out);
+    std::string buffer;
+    bool dropped = sendAll(fd, out) && receiveMessage(fd, buffer, message) && (message.values[0] == 0.0);
+
+    // non-finite raw values are dropped, the rest of the batch is merged
+    double values[] = {3.0, NAN, 1.0, INFINITY, 2.0, -INFINITY};
+    message.type = rtstat::Message::Values;
+    message.key = "nonfinite";
+    message.values.assign(values, values + sizeof(values)/sizeof(values[0]));
+    out.clear();
+    message.encode(out);
+    message.type = rtstat::Message::Query;
+    message.values.assign(q, q + 1);
+    message.encode(out);
+    bool finite = sendAll(fd, out) && receiveMessage(fd, buffer, message) && (message.values[0] == 3.0) 
+        && (message.values[1] >= 1.0) && (message.values[1] <= 3.0);
+
+    // digest payload of even count of doubles
+    message.type = rtstat::Message::Digest;
+    message.values.assign(4, 1.0);
+    out.clear();
+    message.encode(out);
+    char chunk[64];
+    bool closed = sendAll(fd, out) && (recv(fd, chunk, sizeof(chunk), 0) == 0);
+    close(fd);
+
+    printf("malformed digests dropped: %s, non-finite values dropped: %s, malformed frame closes connection: %s\n", 
+        dropped ? "yes" : "no", finite ? "yes" : "no", closed ? "yes" : "no");
+    return dropped && finite && closed;
+}
+
+// rtstat_loadgen <socket path> [clients] [messages per client] [keys] [values per message] [raw|malformed]
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <socket path> [clients] [messages] [keys] [batch] [raw|malformed]\n", argv[0]);
+        return 1;
+    }
+    size_t clients = (argc > 2) ? atoi(argv[2]) : 4;
+    size_t messages = (argc > 3) ? atoi(argv[3]) : 100000;
+    size_t keys = (argc > 4) ? atoi(argv[4]) : 16;
+    size_t batch = (argc > 5) ? atoi(argv[5]) : 100;
+    bool raw = (argc > 6) && (strcmp(argv[6], "raw") == 0);
+    if ((argc > 6) && (strcmp(argv[6], "malformed") == 0) && !runMalformed(argv[1])) {
+        return 1;
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<double> weights(clients);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i=0; i<clients; ++i) {
+        threads.push_back(std::thread(runClient, argv[1], i, messages, keys, batch, raw, &weights[i]));
+    }
+    for (auto it=threads.begin(); it!=threads.end(); ++it) {
+        it->join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    // every client queries every key after its own messages, so the last reply of a key covers all clients
+    double weight = 0;
+    for (auto it=weights.begin(); it!=weights.end(); ++it) {
+        weight = std::max(weight, *it);
+    }
+    size_t total = clients*messages;
+    printf("%s: %zu, time (sec): %f, per second: %.0f, observations: %.0f of %zu\n", raw ? "batches" : "digests", 
+        total, diff.count(), total/diff.count(), weight, total*batch);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <string.h>
+#include "message.hpp"
+
+namespace rtstat {
+
+void Message::setDigest(const std::string& key, const TDigest::View& view)
+{
+    type = Digest;
+    this->key = key;
+    values.resize(3 + 2*view.count);
+    values[0] = view.min;
+    values[1] = view.max;
+    values[2] = view.totalWeight;
+    for (size_t i=0; i<view.count; ++i) {
+        values[3 + 2*i] = view.centroids[i].value();
+        values[4 + 2*i] = view.centroids[i].weight();
+    }
+}
+
+TDigest::View Message::view(std::vector<TDigest::WeightedPoint>& storage) const
+{
+    if ((type != Digest) || (values.size() < 3) || (values.size() % 2 == 0)) {
+        return TDigest::View();
+    }
+    size_t count = (values.size() - 3)/2;
+    storage.resize(count);
+    for (size_t i=0; i<count; ++i) {
+        storage[i].set(values[3 + 2*i], values[4 + 2*i]);
+    }
+    TDigest::View view(storage.data(), count, values[0], values[1], values[2]);
+    return view.valid() ? view : TDigest::View();
+}
+
+bool Message::encode(std::string& out) const
+{
+    if ((key.size() > MAX_KEY_SIZE) || (key.size() + values.size()*sizeof(double) > MAX_SIZE)) {
+        return false;
+    }
+    uint32_t size = key.size() + values.size()*sizeof(double);
+    uint16_t keySize = key.size();
+    char header[HEADER_SIZE] = {0};
+    memcpy(header, &size, sizeof(size));
+    header[4] = static_cast<char>(type);
+    memcpy(header + 6, &keySize, sizeof(keySize));
+
+    out.append(header, HEADER_SIZE);
+    out.append(key);
+    out.append(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(double));
+    return true;
+}
+
+size_t Message::decode(const char* data, size_t size, Message& message, bool* malformed)
+{
+    *malformed = false;
+    if (size < HEADER_SIZE) {
+        return 0;
+    }
+    uint32_t frameSize;
+    uint16_t keySize;
+    memcpy(&frameSize, data, sizeof(frameSize));
+    memcpy(&keySize, data + 6, sizeof(keySize));
+    uint8_t type = data[4];
+    if ((frameSize > MAX_SIZE) || (keySize > frameSize) || ((frameSize - keySize) % sizeof(double) != 0)
+        || (type < Digest) || (type > Quantiles)) {
+        *malformed = true;
+        return 0;
+    }
+    if (size < HEADER_SIZE + frameSize) {
+        return 0;
+    }
+
+    // Digest payload is min, max, totalWeight and pairs of value and weight
+    if ((type == Digest) && (((frameSize - keySize)/sizeof(double) < 3) || ((frameSize - keySize)/sizeof(double) % 2 == 0))) {
+        *malformed = true;
+        return 0;
+    }
+
+    message.type = static_cast<Type>(type);
+    message.key.assign(data + HEADER_SIZE, keySize);
+    message.values.resize((frameSize - keySize)/sizeof(double));
+    memcpy(message.values.data(), data + HEADER_SIZE + keySize, frameSize - keySize);
+    return HEADER_SIZE + frameSize;
+}
+
+}
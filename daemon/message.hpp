@@ -0,0 +1,73 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "tdigest.hpp"
+
+namespace rtstat
+{
+
+// Wire message of aggregation daemon: 8 bytes header, key and payload of doubles in host byte order
+//    (the daemon is local only), header is size of key and payload, type and key size.
+//    Payload by type:
+//        Digest    - min, max, totalWeight, value and weight of every centroid
+//        Values    - observation values
+//        Query     - quantiles
+//        Quantiles - totalWeight and estimated values of queried quantiles, reply to Query
+class Message
+{
+    public:
+        enum Type {
+            Digest = 1,
+            Values = 2,
+            Query = 3,
+            Quantiles = 4
+        };
+
+        static const size_t HEADER_SIZE = 8;
+        static const size_t MAX_SIZE = 64*1024*1024; // max size of key and payload
+        static const size_t MAX_KEY_SIZE = 65535;
+
+        Message(): type(Values) {};
+
+        void setDigest(const std::string& key, const TDigest::View& view);
+        // view of Digest payload, centroids are copied into storage, empty view if payload is not valid digest
+        TDigest::View view(std::vector<TDigest::WeightedPoint>& storage) const;
+
+        bool encode(std::string& out) const; // append frame to out, return false if key or payload is too long
+        // decode frame from data, return size of decoded frame, 0 if frame is incomplete or malformed (*malformed is set)
+        static size_t decode(const char* data, size_t size, Message& message, bool* malformed);
+
+        Type type;
+        std::string key;
+        std::vector<double> values; // payload
+};
+
+} // namespace rtstat
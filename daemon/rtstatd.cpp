@@ -0,0 +1,65 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include "server.hpp"
+
+static rtstat::Server* server = NULL;
+
+static void onSignal(int)
+{
+    if (server) {
+        server->stop();
+    }
+}
+
+// rtstatd <socket path> [workers] [delta]
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <socket path> [workers] [delta]\n", argv[0]);
+        return 1;
+    }
+    size_t workers = (argc > 2) ? atoi(argv[2]) : 4;
+    size_t delta = (argc > 3) ? atoi(argv[3]) : 100;
+
+    rtstat::Server instance(workers, delta);
+    if (!instance.listen(argv[1])) {
+        perror("listen");
+        return 1;
+    }
+    server = &instance;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    instance.run();
+    server = NULL;
+    printf("digests: %zu, values: %zu, queries: %zu, rejected values: %zu\n", instance.digestCount(), instance.valueCount(), 
+        instance.queryCount(), instance.rejectedCount());
+
+    return 0;
+}
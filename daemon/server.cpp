@@ -0,0 +1,450 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cmath>
+#include "server.hpp"
+
+namespace rtstat {
+
+static const uint64_t LISTEN_ID = 0;
+static const uint64_t EVENT_ID = 1;
+static const size_t READ_CHUNK = 64*1024;
+static const size_t MAX_READS = 16; // chunks read from connection per wakeup, the rest waits for the next one
+static const size_t MAX_TASKS = 64*1024; // queued tasks per worker, connections are not read while it is reached
+
+Server::Server(size_t workerCount, size_t delta, size_t excessiveGrowthPCT)
+    : delta_(delta), excessiveGrowthPCT_(excessiveGrowthPCT), workers_(std::max<size_t>(workerCount, 1)),
+    listenFd_(-1), epollFd_(-1), eventFd_(-1), stopping_(false), nextId_(EVENT_ID + 1), digests_(0), values_(0), queries_(0),
+    rejected_(0), pausing_(false)
+{
+}
+
+Server::~Server()
+{
+    for (auto it=connections_.begin(); it!=connections_.end(); ++it) {
+        ::close(it->second.fd);
+    }
+    if (listenFd_ >= 0) { ::close(listenFd_); }
+    if (epollFd_ >= 0) { ::close(epollFd_); }
+    if (eventFd_ >= 0) { ::close(eventFd_); }
+    if (!path_.empty()) {
+        unlink(path_.c_str());
+    }
+}
+
+bool Server::listen(const char* path)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((listenFd_ < 0) || (epollFd_ < 0) || (eventFd_ < 0)) {
+        return false;
+    }
+    unlink(path);
+    if (bind(listenFd_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        return false;
+    }
+    path_ = path;
+    if (::listen(listenFd_, SOMAXCONN) != 0) {
+        return false;
+    }
+    watch(LISTEN_ID, listenFd_, false);
+    watch(EVENT_ID, eventFd_, false);
+    return true;
+}
+
+void Server::stop()
+{
+    stopping_.store(true);
+    uint64_t one = 1;
+    if (write(eventFd_, &one, sizeof(one)) < 0) {
+        // event counter overflow, the loop is woken anyway
+    }
+}
+
+void Server::watch(uint64_t id, int fd, bool output, bool input)
+{
+    struct epoll_event event;
+    event.events = (input ? static_cast<uint32_t>(EPOLLIN) : 0u) | (output ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u64 = id;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event) != 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void Server::run()
+{
+    for (auto it=workers_.begin(); it!=workers_.end(); ++it) {
+        Worker& worker = *it;
+        worker.thread = std::thread([this, &worker]() { work(worker); });
+    }
+
+    struct epoll_event events[64];
+    while (!stopping_.load()) {
+        int count = epoll_wait(epollFd_, events, 64, -1);
+        if ((count < 0) && (errno != EINTR)) {
+            break;
+        }
+        for (int i=0; i<count; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID) {
+                accept();
+            }
+            else if (id == EVENT_ID) {
+                uint64_t value;
+                while (read(eventFd_, &value, sizeof(value)) > 0) {}
+                deliver();
+                resume();
+            }
+            else {
+                if (events[i].events & EPOLLOUT) {
+                    send(id);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive(id);
+                }
+            }
+        }
+    }
+
+    for (auto it=workers_.begin(); it!=workers_.end(); ++it) {
+        {
+            std::lock_guard<std::mutex> guard(it->lock);
+            it->stopping = true;
+        }
+        it->ready.notify_one();
+    }
+    for (auto it=workers_.begin(); it!=workers_.end(); ++it) {
+        it->thread.join();
+    }
+}
+
+void Server::accept()
+{
+    while (true) {
+        int fd = accept4(listenFd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        uint64_t id = nextId_++;
+        connections_[id].fd = fd;
+        watch(id, fd, false);
+    }
+}
+
+void Server::receive(uint64_t id)
+{
+    auto found = connections_.find(id);
+    if (found == connections_.end()) {
+        return;
+    }
+    Connection& connection = found->second;
+    if (connection.paused) {
+        return;
+    }
+    if (congested()) {
+        // workers wake the loop when they take their tasks, pausing_ is set before the second check to not miss it
+        pausing_.store(true);
+        if (congested()) {
+            connection.paused = true;
+            paused_.push_back(id);
+            watch(id, connection.fd, !connection.writable, false);
+            return;
+        }
+    }
+
+    // epoll is level triggered, so data left after MAX_READS chunks wakes the loop again after other connections
+    bool closed = false;
+    for (size_t reads=0; reads<MAX_READS; ++reads) {
+        size_t size = connection.input.size();
+        connection.input.resize(size + READ_CHUNK);
+        ssize_t received = read(connection.fd, &connection.input[size], READ_CHUNK);
+        connection.input.resize(size + std::max<ssize_t>(received, 0));
+        if (received == 0) {
+            closed = true;
+            break;
+        }
+        if (received < 0) {
+            closed = (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR);
+            if (errno != EINTR) {
+                break;
+            }
+        }
+    }
+
+    // messages are dispatched to workers by key, so messages of the same key are processed in order
+    std::vector<std::vector<Task> > batches(workers_.size());
+    size_t offset = 0;
+    bool malformed = false;
+    while (true) {
+        Task task;
+        size_t size = Message::decode(connection.input.data() + offset, connection.input.size() - offset, task.message, &malformed);
+        if (size == 0) {
+            break;
+        }
+        offset += size;
+        task.connection = id;
+        size_t shard = std::hash<std::string>()(task.message.key) % workers_.size();
+        batches[shard].push_back(std::move(task));
+    }
+    connection.input.erase(0, offset);
+
+    for (size_t i=0; i<batches.size(); ++i) {
+        if (batches[i].empty()) {
+            continue;
+        }
+        Worker& worker = workers_[i];
+        {
+            std::lock_guard<std::mutex> guard(worker.lock);
+            std::move(batches[i].begin(), batches[i].end(), std::back_inserter(worker.tasks));
+        }
+        worker.ready.notify_one();
+    }
+
+    if (closed || malformed) {
+        close(id);
+    }
+}
+
+void Server::send(uint64_t id)
+{
+    auto found = connections_.find(id);
+    if (found == connections_.end()) {
+        return;
+    }
+    Connection& connection = found->second;
+    size_t offset = 0;
+    while (offset < connection.output.size()) {
+        ssize_t sent = ::send(connection.fd, connection.output.data() + offset, connection.output.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                close(id);
+                return;
+            }
+            break;
+        }
+        offset += sent;
+    }
+    connection.output.erase(0, offset);
+
+    bool writable = connection.output.empty();
+    if (writable != connection.writable) {
+        connection.writable = writable;
+        watch(id, connection.fd, !writable, !connection.paused);
+    }
+}
+
+// true if a worker queue is full
+bool Server::congested()
+{
+    for (auto it=workers_.begin(); it!=workers_.end(); ++it) {
+        std::lock_guard<std::mutex> guard(it->lock);
+        if (it->tasks.size() >= MAX_TASKS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// watch input of paused connections again once worker queues are below the limit
+void Server::resume()
+{
+    if (!paused_.empty() && congested()) {
+        return;
+    }
+    pausing_.store(false);
+    for (auto it=paused_.begin(); it!=paused_.end(); ++it) {
+        auto found = connections_.find(*it);
+        if (found == connections_.end()) {
+            continue;
+        }
+        found->second.paused = false;
+        watch(*it, found->second.fd, !found->second.writable);
+    }
+    paused_.clear();
+}
+
+void Server::deliver()
+{
+    std::vector<Reply> replies;
+    {
+        std::lock_guard<std::mutex> guard(replyLock_);
+        replies.swap(replies_);
+    }
+    for (auto it=replies.begin(); it!=replies.end(); ++it) {
+        auto found = connections_.find(it->connection);
+        if (found == connections_.end()) {
+            continue;
+        }
+        found->second.output.append(it->frame);
+        if (found->second.writable) {
+            send(it->connection);
+        }
+    }
+}
+
+void Server::close(uint64_t id)
+{
+    auto found = connections_.find(id);
+    if (found == connections_.end()) {
+        return;
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, found->second.fd, NULL);
+    ::close(found->second.fd);
+    connections_.erase(found);
+}
+
+void Server::reply(uint64_t connection, const Message& message)
+{
+    Reply reply;
+    reply.connection = connection;
+    message.encode(reply.frame);
+    {
+        std::lock_guard<std::mutex> guard(replyLock_);
+        replies_.push_back(std::move(reply));
+    }
+    uint64_t one = 1;
+    if (write(eventFd_, &one, sizeof(one)) < 0) {
+        // event counter overflow, the loop is woken anyway
+    }
+}
+
+void Server::work(Server::Worker& worker)
+{
+    std::vector<Task> tasks;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(worker.lock);
+            worker.ready.wait(guard, [&worker]() { return worker.stopping || !worker.tasks.empty(); });
+            if (worker.tasks.empty()) {
+                return;
+            }
+            tasks.swap(worker.tasks);
+        }
+        if (pausing_.load()) {
+            uint64_t one = 1;
+            if (write(eventFd_, &one, sizeof(one)) < 0) {
+                // event counter overflow, the loop is woken anyway
+            }
+        }
+        process(worker, tasks);
+        tasks.clear();
+    }
+}
+
+TDigest& Server::digest(Server::Worker& worker, const std::string& key)
+{
+    auto found = worker.digests.find(key);
+    if (found == worker.digests.end()) {
+        found = worker.digests.insert(std::make_pair(key, TDigest(delta_, excessiveGrowthPCT_))).first;
+    }
+    return found->second;
+}
+
+// values of key are merged as one sorted batch
+void Server::flushValues(Server::Worker& worker, const std::string& key)
+{
+    auto found = worker.staging.find(key);
+    if ((found == worker.staging.end()) || found->second.empty()) {
+        return;
+    }
+    std::vector<double>& values = found->second;
+    std::sort(values.begin(), values.end());
+    values_.fetch_add(digest(worker, key).merge(values.begin(), values.end()));
+    values.clear();
+}
+
+// tasks received since the previous batch: digests are merged at once, values are staged per key
+//    and merged before a query of the key and at the end of the batch
+void Server::process(Server::Worker& worker, std::vector<Task>& tasks)
+{
+    std::vector<TDigest::WeightedPoint> storage;
+    for (auto it=tasks.begin(); it!=tasks.end(); ++it) {
+        Message& message = it->message;
+        switch (message.type) {
+            case Message::Digest: {
+                TDigest::View view = message.view(storage); // invalid digest is dropped
+                if (view.count > 0) {
+                    digest(worker, message.key).merge(view);
+                    digests_.fetch_add(1);
+                }
+                break;
+            }
+            case Message::Values: {
+                // NaN breaks sort order and merge() stops at the first unsorted value, so non-finite values are dropped
+                std::vector<double>& staging = worker.staging[message.key];
+                size_t size = staging.size();
+                std::copy_if(message.values.begin(), message.values.end(), std::back_inserter(staging),
+                    [](double value) { return std::isfinite(value); });
+                rejected_.fetch_add(message.values.size() - (staging.size() - size));
+                break;
+            }
+            case Message::Query: {
+                flushValues(worker, message.key);
+                TDigest& td = digest(worker, message.key);
+                td.flush();
+                Message response;
+                response.type = Message::Quantiles;
+                response.key = message.key;
+                response.values.resize(message.values.size() + 1);
+                response.values[0] = td.view().totalWeight;
+                for (size_t i=0; i<message.values.size(); ++i) {
+                    response.values[i + 1] = td.quantile(message.values[i]);
+                }
+                reply(it->connection, response);
+                queries_.fetch_add(1);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    for (auto it=worker.staging.begin(); it!=worker.staging.end(); ++it) {
+        flushValues(worker, it->first);
+    }
+}
+
+}
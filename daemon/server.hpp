@@ -0,0 +1,142 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "tdigest.hpp"
+#include "message.hpp"
+
+namespace rtstat
+{
+
+// Local aggregation daemon: epoll event loop accepts clients on Unix domain socket and decodes messages,
+//    worker pool merges digests and values batches per key (keys are sharded between workers),
+//    replies to queries are passed back to event loop and written to the client.
+//    A connection is read up to 1 MB per wakeup, reading of all connections is paused while a worker has 64k tasks queued.
+class Server
+{
+    public:
+        explicit Server(size_t workerCount = 4, size_t delta = 100, size_t excessiveGrowthPCT = 100);
+        ~Server();
+
+        bool listen(const char* path); // bind Unix domain socket, return false on failure
+        void run(); // serve until stop()
+        void stop(); // async-signal-safe
+
+        size_t digestCount() const { return digests_.load(); }; // merged digests
+        size_t valueCount() const { return values_.load(); }; // merged observation values
+        size_t queryCount() const { return queries_.load(); };
+        size_t rejectedCount() const { return rejected_.load(); }; // dropped non-finite observation values
+
+    private:
+        class Connection {
+            public:
+                Connection(): fd(-1), writable(true), paused(false) {};
+
+                int fd;
+                bool writable; // false while waiting for EPOLLOUT
+                bool paused; // input is not watched while worker queues are full
+                std::string input;
+                std::string output;
+        };
+
+        class Task { // message of connection for worker
+            public:
+                uint64_t connection;
+                Message message;
+        };
+
+        class Reply {
+            public:
+                uint64_t connection;
+                std::string frame;
+        };
+
+        class Worker {
+            public:
+                Worker(): stopping(false) {};
+
+                std::thread thread;
+                std::mutex lock;
+                std::condition_variable ready;
+                std::vector<Task> tasks;
+                bool stopping;
+
+                std::map<std::string, TDigest> digests; // owned by worker thread
+                std::map<std::string, std::vector<double> > staging; // values batched per key, owned by worker thread
+        };
+
+        Server(const Server&);
+        Server& operator=(const Server&);
+
+        void work(Worker& worker);
+        void process(Worker& worker, std::vector<Task>& tasks);
+        TDigest& digest(Worker& worker, const std::string& key);
+        void flushValues(Worker& worker, const std::string& key);
+        void reply(uint64_t connection, const Message& message);
+
+        void accept();
+        void receive(uint64_t id);
+        void send(uint64_t id);
+        void deliver(); // move replies of workers to connections
+        void close(uint64_t id);
+        void watch(uint64_t id, int fd, bool output, bool input = true);
+        bool congested(); // true if a worker queue is full
+        void resume(); // watch input of paused connections again
+
+        size_t delta_;
+        size_t excessiveGrowthPCT_;
+        std::vector<Worker> workers_;
+
+        std::string path_; // socket path unlinked by destructor
+        int listenFd_;
+        int epollFd_;
+        int eventFd_; // wakes event loop on stop() and replies
+        std::atomic<bool> stopping_;
+        uint64_t nextId_;
+        std::unordered_map<uint64_t, Connection> connections_;
+
+        std::mutex replyLock_;
+        std::vector<Reply> replies_;
+
+        std::atomic<size_t> digests_;
+        std::atomic<size_t> values_;
+        std::atomic<size_t> queries_;
+        std::atomic<size_t> rejected_;
+        std::atomic<bool> pausing_; // connections are paused, workers wake event loop when they take tasks
+        std::vector<uint64_t> paused_; // connections not read until worker queues are below the limit
+};
+
+} // namespace rtstat
@@ -0,0 +1,118 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "tdigest.hpp"
+#include "p2.hpp"
+#include "lazyp2.hpp"
+
+namespace rtstat
+{
+
+// Recorder of many metrics updated together (e.g. every metric of a request).
+//    Values are staged in small per-metric buffers laid out contiguously, full buffer is flushed
+//    into its estimator at once: T-digest sorts and merges the batch, P2 adds it in arrival order
+//    (sorted runs would skew its marker adjustment).
+//    Estimators are touched once per batch instead of once per value.
+template <class Estimator = TDigest> class MetricSet
+{
+    public:
+        class Sample { // value of metric
+            public:
+                Sample(): metric(0), value(0.0) {};
+                Sample(uint32_t metric, double value): metric(metric), value(value) {};
+
+                uint32_t metric;
+                double value;
+        };
+
+        MetricSet(size_t metricCount, const Estimator& prototype, size_t batchSize = 64)
+            : batchSize_(batchSize ? batchSize : 1), staging_(metricCount*batchSize_), fill_(metricCount, 0),
+            estimators_(metricCount, prototype) {};
+
+        inline void record(uint32_t metric, double value)
+        {
+            uint32_t& fill = fill_[metric];
+            staging_[metric*batchSize_ + fill] = value;
+            if (++fill == batchSize_) {
+                flush(metric);
+            }
+        };
+
+        inline void record(const Sample* samples, size_t count) // values of event
+        {
+            for (const Sample* it=samples; it!=samples + count; ++it) {
+                record(it->metric, it->value);
+            }
+        };
+
+        void flush(uint32_t metric) // flush staged values of metric into its estimator
+        {
+            double* begin = &staging_[metric*batchSize_];
+            flushInto(estimators_[metric], begin, begin + fill_[metric]);
+            fill_[metric] = 0;
+        };
+
+        void flush() // flush staged values of all metrics
+        {
+            for (uint32_t i=0; i<fill_.size(); ++i) {
+                if (fill_[i]) {
+                    flush(i);
+                }
+            }
+        };
+
+        inline size_t metricCount() const { return estimators_.size(); };
+        // estimator of metric, values staged after the last flush are not included
+        inline const Estimator& estimator(uint32_t metric) const { return estimators_[metric]; };
+        inline Estimator& estimator(uint32_t metric) { return estimators_[metric]; };
+
+    private:
+        template <typename T> static void flushInto(BasicTDigest<T>& estimator, double* begin, double* end) 
+        { 
+            std::sort(begin, end); // merge() takes sorted values
+            estimator.merge(begin, end); 
+        };
+        template <typename T> static void flushInto(BasicP2<T>& estimator, const double* begin, const double* end) 
+        { 
+            estimator.add(begin, end); 
+        };
+        static void flushInto(LazyP2& estimator, const double* begin, const double* end) 
+        { 
+            estimator.add(begin, end); 
+        };
+
+        size_t batchSize_;
+        std::vector<double> staging_; // batchSize_ values of every metric, contiguous
+        std::vector<uint32_t> fill_; // staged values count of every metric
+        std::vector<Estimator> estimators_;
+};
+
+} // namespace rtstat
@@ -0,0 +1,226 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "lazyp2.hpp"
+
+namespace rtstat {
+
+inline void LazyP2::PositionTree::addFrom(size_t index, double delta)
+{
+    for (size_t i=index + 1; i<tree_.size(); i += i & (~i + 1)) {
+        tree_[i] += delta;
+    }
+}
+
+inline void LazyP2::PositionTree::addAt(size_t index, double delta)
+{
+    addFrom(index, delta);
+    addFrom(index + 1, -delta);
+}
+
+inline double LazyP2::PositionTree::at(size_t index) const
+{
+    double position = 0;
+    for (size_t i=index + 1; i>0; i -= i & (~i + 1)) {
+        position += tree_[i];
+    }
+    return position;
+}
+
+std::vector<double> LazyP2::cells(size_t count)
+{
+    std::vector<double> quantiles;
+    for (size_t i=1; i<count; ++i) {
+        quantiles.push_back(double(i)/count);
+    }
+    return quantiles;
+}
+
+inline double LazyP2::desiredPosition(size_t index) const
+{
+    return 1 + (count_ - 1)*increments_[index];
+}
+
+void LazyP2::describe(FILE * f) const
+{
+    fprintf(f, "quantiles: %zu, markers: %zu, count: %zu\n        pos    desired     height\n", qcount_, markerCount_, count_);
+    for (size_t i=0; i<markerCount_; ++i) {
+        fprintf(f, " %10.4f %10.4f %10.4f\n", positions_.at(i), desiredPosition(i), heights_[i]);
+    }
+}
+
+void LazyP2::initialize() 
+{
+    std::sort(heights_.begin(), heights_.end());
+
+    size_t i = 1;
+    double leftIncrement = 0;
+    double rightIncrement = 0;
+    for (auto it=increments_.begin(); it!=increments_.end(); ++it, ++i) {
+        if ((i % 2) == 0) {
+            // even marker                                  
+            size_t qidx = (i + 1)/2 - 1;
+            rightIncrement = (qidx < qcount_) ? quantiles_[qidx] : 1;
+            *it = (leftIncrement + rightIncrement)/2;
+        } else {
+            // odd marker
+            *it = leftIncrement = rightIncrement;
+        }
+        positions_.addFrom(i - 1, 1);
+    }
+};
+
+// Stage B.4 for single marker, repeated while marker drift is 1 or more,
+//    neighbour positions don't change meanwhile, so they are read once
+void LazyP2::adjust(size_t index)
+{
+    double desired = desiredPosition(index);
+    double position = positions_.at(index);
+    double prevPosition = positions_.at(index - 1);
+    double nextPosition = positions_.at(index + 1);
+    double& height = heights_[index];
+    double prevHeight = heights_[index - 1];
+    double nextHeight = heights_[index + 1];
+
+    double moved = 0;
+    while (true) {
+        double d = desired - position;
+        double dp = nextPosition - position;
+        double dm = prevPosition - position;
+
+        if ((d >= 1) && (dp > 1)) {
+            double qp = (nextHeight - height)/dp;
+            double qm = (prevHeight - height)/dm;
+            double qt = height + ((1 - dm)*qp + (dp - 1)*qm)/(dp - dm);
+            if ((qt > prevHeight) && (qt < nextHeight)) {
+                height = qt;
+            }
+            else {
+                height += qp;
+            }
+            ++position;
+            ++moved;
+        }
+        else if ((d <= -1) && (dm < -1)) {
+            double qp = (nextHeight - height)/dp;
+            double qm = (prevHeight - height)/dm;
+            double qt = height - ((1 + dp)*qm - (dm + 1)*qp)/(dp - dm);
+            if ((qt > prevHeight) && (qt < nextHeight)) {
+                height = qt;
+            }
+            else {
+                height -= qm;
+            }
+            --position;
+            --moved;
+        }
+        else {
+            break;
+        }
+    }
+
+    if (moved != 0) {
+        positions_.addAt(index, moved);
+    }
+}
+
+void LazyP2::add(double val)
+{
+    ++count_;
+
+    // Stage A. Initialization
+    if (valuesLeftForInit_) {
+        --valuesLeftForInit_;
+        heights_[valuesLeftForInit_] = val;
+
+        if (!valuesLeftForInit_) {
+            initialize();
+        }
+
+        return;
+    }
+
+    // Stage B. Add observations
+    size_t k_index = std::upper_bound (heights_.begin(), heights_.end(), val) - heights_.begin();
+    if (k_index == 0) {
+        // set MIN marker
+        heights_[0] = val;
+        ++k_index;
+    }
+    else if (k_index == markerCount_) {
+        // set MAX marker
+        heights_[markerCount_ - 1] = val;
+        --k_index;
+    }
+
+    // B.3 actual positions of markers k_index and above are incremented at once,
+    //    desired positions follow from observations count
+    positions_.addFrom(k_index, 1);
+
+    // B.4 markers around insertion point
+    size_t last = markerCount_ - 2;
+    adjust(std::max(k_index - 1, size_t(1)));
+    if ((k_index > 1) && (k_index <= last)) {
+        adjust(k_index);
+    }
+
+    // B.4 markers drifted meanwhile, visited round-robin
+    for (size_t i=0; i<sweep_; ++i) {
+        adjust(sweepNext_);
+        sweepNext_ = (sweepNext_ < last) ? sweepNext_ + 1 : 1;
+    }
+};    
+
+bool LazyP2::valid() const 
+{
+    return (valuesLeftForInit_ == 0);
+}
+
+double LazyP2::quantile(size_t qindex) const 
+{
+    if (qindex > qcount_) {
+        return 0;
+    }
+    return heights_[qindex*2 + 2];
+}
+
+double LazyP2::min() const
+{
+    return heights_[0];
+};
+
+double LazyP2::max() const
+{
+    return heights_[markerCount_ - 1];
+};
+
+double LazyP2::count() const
+{
+    return count_;
+};
+
+}
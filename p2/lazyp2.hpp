@@ -0,0 +1,109 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+namespace rtstat
+{
+
+// P2 for large quantiles sets (histogram mode of P-sqared paper).
+//    Desired positions are computed on the fly from observations count, actual positions
+//    are kept in a Fenwick tree, so add() touches only markers around the insertion point
+//    and a few markers visited round-robin, instead of every marker.
+class LazyP2
+{
+    public:
+        explicit LazyP2(std::vector<double> quantiles, size_t sweep = 2)
+            // sweep - markers re-evaluated round-robin per add in addition to insertion neighbours
+            : quantiles_(quantiles), sweep_(sweep), sweepNext_(1), count_(0)
+        {
+            std::sort(quantiles_.begin(), quantiles_.end());
+            qcount_ = quantiles_.size();
+            markerCount_ = qcount_*2 + 3;
+            valuesLeftForInit_ = markerCount_;
+            heights_ = std::vector<double>(markerCount_);
+            increments_ = std::vector<double>(markerCount_);
+            positions_ = PositionTree(markerCount_);
+        };
+
+        // quantiles of equiprobable histogram cells: 1/cells, 2/cells .. (cells-1)/cells
+        static std::vector<double> cells(size_t count);
+
+        void add(double val);
+        // add observation values of any arithmetic type
+        template <typename InputIt> void add(InputIt begin, InputIt end);
+        template <typename T> void add(const T* values, size_t count) { add(values, values + count); };
+
+        bool valid() const; // return true if estimation is valid
+        double quantile(size_t qindex) const;
+        double min() const;
+        double max() const;
+        double count() const; // observations count
+
+        void describe(FILE * f) const;
+
+    private:
+        class PositionTree // Fenwick tree of marker positions increments
+        {
+            public:
+                explicit PositionTree(size_t size = 0): tree_(size + 1, 0.0) {};
+
+                inline void addFrom(size_t index, double delta); // add delta to positions of markers index and above
+                inline void addAt(size_t index, double delta); // add delta to position of marker index only
+                inline double at(size_t index) const; // actual marker position (ni)
+            private:
+                std::vector<double> tree_;
+        };
+
+        void initialize();
+        inline double desiredPosition(size_t index) const; // di = 1 + (N - 1)*fi
+        void adjust(size_t index); // Stage B.4 for single marker until its drift is below 1
+
+        std::vector<double> heights_; // Estimated quantile values (qi)
+        std::vector<double> increments_; // Marker position increments (fi)
+        PositionTree positions_; // Marker positions (ni)
+        std::vector<double> quantiles_;
+        size_t valuesLeftForInit_; // Observation values left for initialization
+        size_t qcount_; // Quantiles count for estimate
+        size_t markerCount_; // Markers count
+        size_t sweep_; // markers re-evaluated round-robin per add
+        size_t sweepNext_; // next marker to re-evaluate round-robin
+        size_t count_; // observations count
+};
+
+template <typename InputIt> void LazyP2::add(InputIt begin, InputIt end)
+{
+    static_assert(std::is_arithmetic<typename std::iterator_traits<InputIt>::value_type>::value, "P2 values must be of arithmetic type");
+    for (InputIt it=begin; it!=end; ++it) {
+        add(static_cast<double>(*it));
+    }
+}
+
+} // namespace rtstat
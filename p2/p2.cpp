@@ -25,18 +25,19 @@ SOFTWARE.
 #include <stdio.h>
 #include <algorithm>
 #include <vector>
+#include <math.h>
 #include "p2.hpp"
 
 namespace rtstat {
 
-inline void P2::Marker::incrementPositions(bool actual) {
+inline void P2Base::Marker::incrementPositions(bool actual) {
     desiredPosition += increment;
     if (actual) {
         ++position;
     }
 }
 
-inline void P2::Marker::adjust(P2::Marker& prev, P2::Marker& next) {
+inline void P2Base::Marker::adjust(P2Base::Marker& prev, P2Base::Marker& next) {
     double d = desiredPosition - position;
     double dp = next.position - position;
     double dm = prev.position - position;
@@ -67,14 +68,45 @@ inline void P2::Marker::adjust(P2::Marker& prev, P2::Marker& next) {
     }
 }
 
-void P2::describe(FILE * f) 
+P2Base::P2Base(const P2Base& other)
+    : quantiles_(other.quantiles_), valuesLeftForInit_(other.valuesLeftForInit_), qcount_(other.qcount_),
+    markerCount_(other.markerCount_), arena_(other.arena_)
 {
-    fprintf(f, "quantiles: %d - ", qcount_);
+    markers_.assign(other.markers_.begin(), other.markers_.end(), arena_);
+}
+
+// markers are taken from other, which may only be destroyed or assigned
+P2Base::P2Base(P2Base&& other)
+    : quantiles_(std::move(other.quantiles_)), valuesLeftForInit_(other.valuesLeftForInit_), qcount_(other.qcount_),
+    markerCount_(other.markerCount_), arena_(other.arena_)
+{
+    markers_.swap(other.markers_);
+}
+
+P2Base& P2Base::operator=(P2Base other)
+{
+    markers_.swap(other.markers_);
+    std::swap(arena_, other.arena_); // other releases old markers with their arena
+    quantiles_.swap(other.quantiles_);
+    valuesLeftForInit_ = other.valuesLeftForInit_;
+    qcount_ = other.qcount_;
+    markerCount_ = other.markerCount_;
+    return *this;
+}
+
+P2Base::~P2Base()
+{
+    markers_.release(arena_);
+}
+
+void P2Base::describe(FILE * f) 
+{
+    fprintf(f, "quantiles: %zu - ", qcount_);
     for (auto it=quantiles_.begin(); it!=quantiles_.end(); ++it) {
         fprintf(f, " %0.5f", *it);
     }
-    fprintf(f, "\nmarkers: %d, min:%10.4f, max:%10.4f\n        pos     height    qantile\n", markerCount_, markers_.front().position, markers_.back().position);
-    unsigned char i = 0;
+    fprintf(f, "\nmarkers: %zu, min:%10.4f, max:%10.4f\n        pos     height    qantile\n", markerCount_, markers_[0].position, markers_[markerCount_ - 1].position);
+    size_t i = 0;
     for (auto it=markers_.begin(); it!=markers_.end(); ++it, ++i) {
         if ((i % 2 == 0) && (i > 0) && (i < markerCount_ - 1) ) {
             fprintf(f, " %10.4f %10.4f %10.4f\n", it->position, it->height, quantiles_[i/2 - 1]);
@@ -93,10 +125,10 @@ void P2::describe(FILE * f)
     }
 }
 
-void P2::initialize() 
+void P2Base::initialize() 
 {
     std::sort(markers_.begin(), markers_.end(), 
-        [](const P2::Marker& a, const P2::Marker& b) { 
+        [](const P2Base::Marker& a, const P2Base::Marker& b) { 
             return a.height < b.height; 
         }
     );
@@ -122,7 +154,7 @@ void P2::initialize()
     }
 };
 
-void P2::add(double val)
+void P2Base::add(double val)
 {
     // Stage A. Initialization
     if (valuesLeftForInit_) {
@@ -138,7 +170,7 @@ void P2::add(double val)
 
     // Stage B. Add observations
     auto K = std::upper_bound (markers_.begin(), markers_.end(), val,
-        [](const double a, const P2::Marker& b) { 
+        [](const double a, const P2Base::Marker& b) { 
             return a < b.height; 
         }
     );
@@ -153,10 +185,10 @@ void P2::add(double val)
         markers_[markerCount_-1].height = val;
     }
 
-    P2::Marker* prev = &markers_[0];
-    P2::Marker* curr = &markers_[1];
+    P2Base::Marker* prev = &markers_[0];
+    P2Base::Marker* curr = &markers_[1];
     for (size_t i=2; i<markerCount_; ++i) {
-        P2::Marker* next = &markers_[i];
+        P2Base::Marker* next = &markers_[i];
 
         // According to B.1-2 
         //    curr marker index 
@@ -175,33 +207,239 @@ void P2::add(double val)
 
 };    
 
-bool P2::valid() const 
+// Piecewise-parabolic (P^2) interpolation of the observations count less or equal to val.
+//    The parabola through markers (c-1, c, c+1) gives the height as function of position
+//       q(n_c + d) = q_c + a*d + b*d^2
+//    and it is inverted inside segment [i, i+1], linear interpolation is used where
+//    the parabola is not monotone on the segment.
+double P2Base::positionOf(double val) const
+{
+    if (val < markers_[0].height) {
+        return 0;
+    }
+    if (val >= markers_[markerCount_ - 1].height) {
+        return markers_[markerCount_ - 1].position;
+    }
+
+    auto K = std::upper_bound (markers_.begin(), markers_.end(), val,
+        [](const double a, const P2Base::Marker& b) { 
+            return a < b.height; 
+        }
+    );
+    size_t i = (K - markers_.begin()) - 1;
+    const P2Base::Marker& left = markers_[i];
+    const P2Base::Marker& right = markers_[i + 1];
+
+    size_t c = (i > 0) ? i : i + 1;
+    const P2Base::Marker& prev = markers_[c - 1];
+    const P2Base::Marker& curr = markers_[c];
+    const P2Base::Marker& next = markers_[c + 1];
+
+    double L = curr.position - prev.position;
+    double R = next.position - curr.position;
+    double sl = (curr.height - prev.height)/L;
+    double sr = (next.height - curr.height)/R;
+    double a = (L*sr + R*sl)/(L + R);
+    double b = (sr - sl)/(L + R);
+
+    double dlo = left.position - curr.position;
+    double dhi = right.position - curr.position;
+    if ((a + 2*b*dlo >= 0) && (a + 2*b*dhi >= 0)) {
+        // increasing root of b*d^2 + a*d - (val - q_c) = 0
+        double v = val - curr.height;
+        double s = a*a + 4*b*v;
+        s = (s > 0) ? sqrt(s) : 0;
+        if (a + s > 0) {
+            double d = 2*v/(a + s);
+            d = (d < dlo) ? dlo : ((d > dhi) ? dhi : d);
+            return curr.position + d;
+        }
+    }
+
+    if (right.height == left.height) {
+        return left.position;
+    }
+    return left.position + (right.position - left.position)*(val - left.height)/(right.height - left.height);
+}
+
+// Merging P2 estimations with the same quantiles set.
+//    Every merged marker i is placed at the desired position 1 + (N - 1)*fi of the joint
+//    stream, its height is the root of Na(x) + Nb(x) = di, where N(x) is the
+//    piecewise-parabolic position interpolation of each side.
+//    Error bound: if markers of both sides have rank errors Ea and Eb, the rank error
+//    of a merged marker doesn't exceed Ea + Eb + Sa + Sb, where S is the positions span of
+//    the side segment bracketing merged height (about (f(k+1) - f(k))*N of that side).
+//    In practice the interpolation error is far below the span, see run_perf_test_p2_merge.
+size_t P2Base::merge(const P2Base& other)
+{
+    if (quantiles_ != other.quantiles_) {
+        return 0;
+    }
+    if (&other == this) {
+        // replay of Stage A and merged markers change markers_ that are read from other
+        P2Base copy(*this);
+        return merge(copy);
+    }
+
+    // Stage A of other side: replay buffered observations
+    if (!other.valid()) {
+        for (size_t i=other.valuesLeftForInit_; i<other.markerCount_; ++i) {
+            add(other.markers_[i].height);
+        }
+        return other.markerCount_ - other.valuesLeftForInit_;
+    }
+    if (!valid()) {
+        std::vector<double> values;
+        for (size_t i=valuesLeftForInit_; i<markerCount_; ++i) {
+            values.push_back(markers_[i].height);
+        }
+        *this = other;
+        for (auto it=values.begin(); it!=values.end(); ++it) {
+            add(*it);
+        }
+        return other.count();
+    }
+
+    double count = markers_[markerCount_ - 1].position + other.markers_[markerCount_ - 1].position;
+    std::vector<Marker> merged(markers_.begin(), markers_.end());
+
+    merged[0].height = std::min(markers_[0].height, other.markers_[0].height);
+    merged[0].position = 1;
+    merged[0].desiredPosition = 1;
+    merged[markerCount_ - 1].height = std::max(markers_[markerCount_ - 1].height, other.markers_[markerCount_ - 1].height);
+    merged[markerCount_ - 1].position = count;
+    merged[markerCount_ - 1].desiredPosition = count;
+
+    // joint positions at heights of both sides bracket every merged marker
+    std::vector<double> heights(markerCount_*2);
+    for (size_t i=0; i<markerCount_; ++i) {
+        heights[i] = markers_[i].height;
+        heights[markerCount_ + i] = other.markers_[i].height;
+    }
+    std::inplace_merge(heights.begin(), heights.begin() + markerCount_, heights.end());
+    std::vector<double> positions(heights.size());
+    for (size_t i=0; i<heights.size(); ++i) {
+        positions[i] = positionOf(heights[i]) + other.positionOf(heights[i]);
+    }
+
+    size_t k = 0;
+    for (size_t i=1; i<markerCount_ - 1; ++i) {
+        Marker& m = merged[i];
+        m.desiredPosition = 1 + (count - 1)*m.increment;
+
+        while ((k + 2 < heights.size()) && (positions[k + 1] < m.desiredPosition)) {
+            ++k;
+        }
+
+        // Illinois method on the bracket [heights[k], heights[k+1]]
+        double lo = heights[k];
+        double hi = heights[k + 1];
+        double flo = positions[k] - m.desiredPosition;
+        double fhi = positions[k + 1] - m.desiredPosition;
+        double height = (flo >= 0) ? lo : hi;
+        int side = 0;
+        for (size_t j=0; (j < 32) && (flo < 0) && (fhi > 0) && (lo < hi); ++j) {
+            height = (lo*fhi - hi*flo)/(fhi - flo);
+            double f = positionOf(height) + other.positionOf(height) - m.desiredPosition;
+            if (fabs(f) < 1e-6) {
+                break;
+            }
+            if (f > 0) {
+                hi = height; fhi = f;
+                if (side == 1) { flo /= 2; }
+                side = 1;
+            }
+            else {
+                lo = height; flo = f;
+                if (side == -1) { fhi /= 2; }
+                side = -1;
+            }
+        }
+        m.height = (height < merged[i - 1].height) ? merged[i - 1].height : height;
+
+        // keep positions integer and strictly increasing
+        double position = floor(m.desiredPosition + 0.5);
+        double minPosition = merged[i - 1].position + 1;
+        double maxPosition = count - (markerCount_ - 1 - i);
+        m.position = (position < minPosition) ? minPosition : ((position > maxPosition) ? maxPosition : position);
+    }
+
+    std::copy(merged.begin(), merged.end(), markers_.begin());
+
+    return other.count();
+}
+
+bool P2Base::valid() const 
 {
     return (valuesLeftForInit_ == 0);
 }
 
-double P2::quantile(unsigned char qindex) const 
+double P2Base::quantile(size_t qindex) const 
 {
-    if ((qindex < 0) || (qindex > qcount_)) {
+    if (qindex > qcount_) {
         return 0;
     }
     return markers_[qindex*2 + 2].height;
 }
 
-double P2::min() const
+double P2Base::min() const
 {
     return markers_[0].height;
 };
 
-double P2::max() const
+double P2Base::max() const
 {
-    return markers_[markerCount_].height;
+    return markers_[markerCount_ - 1].height;
 };
 
-double P2::count() const
+double P2Base::count() const
 {
-    return markers_[markerCount_].position;
+    if (!valid()) {
+        return markerCount_ - valuesLeftForInit_;
+    }
+    return markers_[markerCount_ - 1].position;
 };
 
+void P2Base::snapshot(P2Base::Snapshot& snapshot) const
+{
+    snapshot.quantiles.resize(qcount_);
+    for (size_t i=0; i<qcount_; ++i) {
+        snapshot.quantiles[i] = markers_[i*2 + 2].height;
+    }
+    snapshot.min = min();
+    snapshot.max = max();
+    snapshot.count = count();
+    snapshot.valid = valid();
+}
+
+
+template <typename T> void BasicP2<T>::add(T value)
+{
+    // min and max are compared in T, markers are compared after the single conversion to double
+    if (empty_ || (value < min_)) { min_ = value; }
+    if (empty_ || (value > max_)) { max_ = value; }
+    sum_ += value;
+    empty_ = false;
+    P2Base::add(static_cast<double>(value));
+}
+
+template <typename T> size_t BasicP2<T>::merge(const BasicP2<T>& other)
+{
+    size_t count = P2Base::merge(other);
+    if (count && !other.empty_) {
+        if (empty_ || (other.min_ < min_)) { min_ = other.min_; }
+        if (empty_ || (other.max_ > max_)) { max_ = other.max_; }
+        sum_ += other.sum_;
+        empty_ = false;
+    }
+    return count;
+}
+
+template class BasicP2<double>;
+template class BasicP2<float>;
+template class BasicP2<int32_t>;
+template class BasicP2<uint32_t>;
+template class BasicP2<int64_t>;
+template class BasicP2<uint64_t>;
 
 }
\ No newline at end of file
@@ -24,33 +24,61 @@ SOFTWARE.
 
 #pragma once
 
+#include <stdint.h>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+#include "arena.hpp"
 
 namespace rtstat
 {
 
-class P2
+// P-sqared markers and algorithms on double values, ingestion is typed by BasicP2<T>
+class P2Base
 {
     public:
-        explicit P2(std::vector<double> quantiles)
-            : quantiles_(std::vector<double>(quantiles))
+        class Snapshot // immutable copy of estimation for concurrent readers, filled by P2Base::snapshot()
+        {
+            public:
+                Snapshot(): min(0.0), max(0.0), count(0.0), valid(false) {};
+
+                std::vector<double> quantiles; // estimated values in the order of sorted quantiles
+                double min;
+                double max;
+                double count;
+                bool valid;
+        };
+
+        explicit P2Base(std::vector<double> quantiles, Arena* arena = NULL) // arena - storage of markers, NULL - heap
+            : quantiles_(std::vector<double>(quantiles)), arena_(arena)
         {
-            std:sort(quantiles_.begin(), quantiles_.end());
+            std::sort(quantiles_.begin(), quantiles_.end());
             qcount_ = quantiles.size();
             markerCount_ = qcount_*2 + 3;
             valuesLeftForInit_ = markerCount_;
-            markers_ = std::vector<Marker>(markerCount_);
+            markers_.resize(markerCount_, arena_);
         };
+        P2Base(const P2Base& other); // copy is allocated from arena of other
+        P2Base(P2Base&& other);
+        P2Base& operator=(P2Base other);
+        ~P2Base();
 
-        void add(double val);
         bool valid() const; // return true if estimation is valid
-        double quantile(unsigned char qindex) const;
+        double quantile(size_t qindex) const;
         double min() const;
         double max() const;
         double count() const; // observations count
+        void snapshot(Snapshot& snapshot) const; // copy estimation into snapshot reusing its memory
 
         void describe(FILE * f);
 
+    protected:
+        void add(double val);
+        // merging P2 estimation with the same quantiles set, return count of merged observations
+        size_t merge(const P2Base& other);
+
     private:
         class Marker
         {
@@ -68,13 +96,59 @@ class P2
             double increment; // Marker position increment (fi)
         };
 
+        typedef ArenaArray<Marker> Markers;
+
         void initialize();
+        double positionOf(double val) const; // interpolated count of observations less or equal to val
 
-        std::vector<Marker> markers_;
+        Markers markers_;
         std::vector<double> quantiles_;
         size_t valuesLeftForInit_; // Observation values left for initialization
-        unsigned char qcount_; // Quantiles count for estimate
-        unsigned char markerCount_; // Markers count
+        size_t qcount_; // Quantiles count for estimate
+        size_t markerCount_; // Markers count
+        Arena* arena_; // storage of markers, NULL - heap
 };
 
+// P2 estimation of observation values of type T. Markers are double as interpolation requires it,
+//    min, max and sum of observations are kept exactly in T (sum in 64-bit integer for integer types).
+//    Instantiated for double, float, int32_t, uint32_t, int64_t and uint64_t.
+template <typename T> class BasicP2 : public P2Base
+{
+    static_assert(std::is_arithmetic<T>::value, "P2 values must be of arithmetic type");
+
+    public:
+        typedef typename std::conditional<std::is_integral<T>::value, 
+            typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type, double>::type Sum;
+
+        explicit BasicP2(std::vector<double> quantiles, Arena* arena = NULL)
+            : P2Base(quantiles, arena), min_(0), max_(0), sum_(0), empty_(true) {};
+
+        void add(T value);
+        // add observation values of any arithmetic type
+        template <typename InputIt> void add(InputIt begin, InputIt end);
+        template <typename V> void add(const V* values, size_t count) { add(values, values + count); };
+        // merging P2 estimation with the same quantiles set, return count of merged observations
+        size_t merge(const BasicP2& other);
+
+        inline T min() const { return min_; }; // exact minimal observation
+        inline T max() const { return max_; }; // exact maximal observation
+        inline Sum sum() const { return sum_; }; // exact sum of observations
+
+    private:
+        T min_;
+        T max_;
+        Sum sum_;
+        bool empty_;
+};
+
+template <typename T> template <typename InputIt> void BasicP2<T>::add(InputIt begin, InputIt end)
+{
+    static_assert(std::is_arithmetic<typename std::iterator_traits<InputIt>::value_type>::value, "P2 values must be of arithmetic type");
+    for (InputIt it=begin; it!=end; ++it) {
+        add(static_cast<T>(*it));
+    }
+}
+
+typedef BasicP2<double> P2;
+
 } // namespace rtstat
\ No newline at end of file
@@ -0,0 +1,302 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace rtstat
+{
+
+// scalar lane of P2Batch, also runs series left over by SIMD lanes width
+class P2ScalarLanes
+{
+    public:
+        typedef double V;
+        typedef bool M;
+        static const size_t width = 1;
+
+        static inline V load(const double* p) { return *p; };
+        static inline void store(double* p, V a) { *p = a; };
+        static inline V set(double a) { return a; };
+        static inline V add(V a, V b) { return a + b; };
+        static inline V sub(V a, V b) { return a - b; };
+        static inline V mul(V a, V b) { return a * b; };
+        static inline V div(V a, V b) { return a / b; };
+        static inline M lt(V a, V b) { return a < b; };
+        static inline M le(V a, V b) { return a <= b; };
+        static inline M both(M a, M b) { return a && b; };
+        static inline M either(M a, M b) { return a || b; };
+        static inline V blend(M m, V a, V b) { return m ? a : b; };
+        static inline bool any(M m) { return m; };
+};
+
+// SIMD lanes of P2Batch: AVX (4 doubles), SSE2 (2 doubles) or scalar,
+//    masks are all-ones lanes, blend(m, a, b) selects a where m is set
+#if defined(__AVX__)
+class P2Lanes
+{
+    public:
+        typedef __m256d V;
+        typedef __m256d M;
+        static const size_t width = 4;
+
+        static inline V load(const double* p) { return _mm256_loadu_pd(p); };
+        static inline void store(double* p, V a) { _mm256_storeu_pd(p, a); };
+        static inline V set(double a) { return _mm256_set1_pd(a); };
+        static inline V add(V a, V b) { return _mm256_add_pd(a, b); };
+        static inline V sub(V a, V b) { return _mm256_sub_pd(a, b); };
+        static inline V mul(V a, V b) { return _mm256_mul_pd(a, b); };
+        static inline V div(V a, V b) { return _mm256_div_pd(a, b); };
+        static inline M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); };
+        static inline M le(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); };
+        static inline M both(M a, M b) { return _mm256_and_pd(a, b); };
+        static inline M either(M a, M b) { return _mm256_or_pd(a, b); };
+        static inline V blend(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); };
+        static inline bool any(M m) { return _mm256_movemask_pd(m) != 0; };
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+class P2Lanes
+{
+    public:
+        typedef __m128d V;
+        typedef __m128d M;
+        static const size_t width = 2;
+
+        static inline V load(const double* p) { return _mm_loadu_pd(p); };
+        static inline void store(double* p, V a) { _mm_storeu_pd(p, a); };
+        static inline V set(double a) { return _mm_set1_pd(a); };
+        static inline V add(V a, V b) { return _mm_add_pd(a, b); };
+        static inline V sub(V a, V b) { return _mm_sub_pd(a, b); };
+        static inline V mul(V a, V b) { return _mm_mul_pd(a, b); };
+        static inline V div(V a, V b) { return _mm_div_pd(a, b); };
+        static inline M lt(V a, V b) { return _mm_cmplt_pd(a, b); };
+        static inline M le(V a, V b) { return _mm_cmple_pd(a, b); };
+        static inline M both(M a, M b) { return _mm_and_pd(a, b); };
+        static inline M either(M a, M b) { return _mm_or_pd(a, b); };
+        static inline V blend(M m, V a, V b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); };
+        static inline bool any(M m) { return _mm_movemask_pd(m) != 0; };
+};
+#else
+typedef P2ScalarLanes P2Lanes;
+#endif
+
+// P2 estimation of the same quantiles set over W independent series updated in lockstep.
+//    Markers are stored interleaved by series (marker-major, series-minor), desired positions
+//    are shared by all series, and stage B runs over P2Lanes::width series at once with blends
+//    in place of Marker::adjust branches, the last W % P2Lanes::width series run in scalar lanes.
+template <size_t W> class P2Batch
+{
+    public:
+        explicit P2Batch(std::vector<double> quantiles)
+            : quantiles_(quantiles)
+        {
+            std::sort(quantiles_.begin(), quantiles_.end());
+            qcount_ = quantiles_.size();
+            markerCount_ = qcount_*2 + 3;
+            valuesLeftForInit_ = markerCount_;
+            heights_ = std::vector<double>(markerCount_*W);
+            positions_ = std::vector<double>(markerCount_*W);
+            desiredPositions_ = std::vector<double>(markerCount_);
+            increments_ = std::vector<double>(markerCount_);
+        };
+
+        void add(const double* values); // add one observation value per series
+        bool valid() const { return (valuesLeftForInit_ == 0); }; // return true if estimation is valid
+        double quantile(size_t series, size_t qindex) const;
+        double min(size_t series) const { return heights_[series]; };
+        double max(size_t series) const { return heights_[(markerCount_ - 1)*W + series]; };
+        double count() const; // observations count of each series
+
+    private:
+        static const size_t VECTOR_SERIES = W - W % P2Lanes::width; // series updated in SIMD lanes
+
+        void initialize();
+        template <class L> void locate(const double* values, double* k, size_t l); // stage B.1 of L::width series from l
+        template <class L> void adjust(size_t i, const double* k, size_t l); // stage B.3-4 of marker i
+
+        std::vector<double> heights_; // Estimated quantile values (qi) [marker*W + series]
+        std::vector<double> positions_; // Marker positions (ni) [marker*W + series]
+        std::vector<double> desiredPositions_; // Desired marker positions (di), the same for every series
+        std::vector<double> increments_; // Marker position increments (fi)
+        std::vector<double> quantiles_;
+        size_t valuesLeftForInit_; // Observation values left for initialization
+        size_t qcount_; // Quantiles count for estimate
+        size_t markerCount_; // Markers count
+};
+
+template <size_t W> void P2Batch<W>::initialize()
+{
+    std::vector<double> column(markerCount_);
+    for (size_t l=0; l<W; ++l) {
+        for (size_t i=0; i<markerCount_; ++i) {
+            column[i] = heights_[i*W + l];
+        }
+        std::sort(column.begin(), column.end());
+        for (size_t i=0; i<markerCount_; ++i) {
+            heights_[i*W + l] = column[i];
+            positions_[i*W + l] = i + 1;
+        }
+    }
+
+    double leftIncrement = 0;
+    double rightIncrement = 0;
+    for (size_t i=1; i<=markerCount_; ++i) {
+        double increment = 0;
+        if ((i % 2) == 0) {
+            // even marker                                  
+            size_t qidx = (i + 1)/2 - 1;
+            rightIncrement = (qidx < qcount_) ? quantiles_[qidx] : 1;
+            increment = (leftIncrement + rightIncrement)/2;
+        } else {
+            // odd marker
+            increment = leftIncrement = rightIncrement;
+        }
+        increments_[i - 1] = increment;
+        desiredPositions_[i - 1] = 1 + 2*(qcount_ + 1)*increment;
+    }
+}
+
+template <size_t W> template <class L> inline void P2Batch<W>::locate(const double* values, double* k, size_t l)
+{
+    const typename L::V one = L::set(1);
+    const typename L::V zero = L::set(0);
+    double* hmin = &heights_[0];
+    double* hmax = &heights_[(markerCount_ - 1)*W];
+    typename L::V v = L::load(values + l);
+    typename L::V kl = zero;
+    for (size_t i=0; i<markerCount_; ++i) {
+        kl = L::add(kl, L::blend(L::le(L::load(&heights_[i*W + l]), v), one, zero));
+    }
+    typename L::V h0 = L::load(hmin + l);
+    typename L::V hm = L::load(hmax + l);
+    L::store(hmin + l, L::blend(L::lt(v, h0), v, h0));
+    L::store(hmax + l, L::blend(L::lt(hm, v), v, hm));
+    L::store(k + l, L::blend(L::lt(kl, one), one, kl));
+}
+
+// both adjust directions are blended by sign s
+template <size_t W> template <class L> inline void P2Batch<W>::adjust(size_t i, const double* k, size_t l)
+{
+    const typename L::V one = L::set(1);
+    const typename L::V minusOne = L::set(-1);
+    const typename L::V zero = L::set(0);
+    const typename L::V desired = L::set(desiredPositions_[i]);
+    const typename L::V index = L::set(i);
+    typename L::V hp = L::load(&heights_[(i - 1)*W + l]);
+    typename L::V np = L::load(&positions_[(i - 1)*W + l]);
+    typename L::V h = L::load(&heights_[i*W + l]);
+    typename L::V n = L::load(&positions_[i*W + l]);
+    typename L::V hn = L::load(&heights_[(i + 1)*W + l]);
+    typename L::V nn = L::load(&positions_[(i + 1)*W + l]);
+
+    n = L::add(n, L::blend(L::le(L::load(k + l), index), one, zero));
+
+    typename L::V d = L::sub(desired, n);
+    typename L::V dp = L::sub(nn, n);
+    typename L::V dm = L::sub(np, n);
+    typename L::M up = L::both(L::le(one, d), L::lt(one, dp));
+    typename L::M down = L::both(L::le(d, minusOne), L::lt(dm, minusOne));
+    typename L::M moved = L::either(up, down);
+    if (!L::any(moved)) {
+        L::store(&positions_[i*W + l], n);
+        return;
+    }
+    typename L::V s = L::blend(up, one, L::blend(down, minusOne, zero));
+
+    // parabolic prediction, linear one if it is out of neighbours heights
+    typename L::V qp = L::div(L::sub(hn, h), dp);
+    typename L::V qm = L::div(L::sub(hp, h), dm);
+    typename L::V qt = L::add(h, L::div(L::mul(s, L::add(L::mul(L::sub(s, dm), qp), L::mul(L::sub(dp, s), qm))), L::sub(dp, dm)));
+    typename L::V ql = L::add(h, L::blend(up, qp, L::sub(zero, qm)));
+    typename L::V q = L::blend(L::both(L::lt(hp, qt), L::lt(qt, hn)), qt, ql);
+
+    L::store(&heights_[i*W + l], L::blend(moved, q, h));
+    L::store(&positions_[i*W + l], L::add(n, s));
+}
+
+template <size_t W> void P2Batch<W>::add(const double* values)
+{
+    // Stage A. Initialization
+    if (valuesLeftForInit_) {
+        --valuesLeftForInit_;
+        std::copy(values, values + W, heights_.begin() + valuesLeftForInit_*W);
+
+        if (!valuesLeftForInit_) {
+            initialize();
+        }
+
+        return;
+    }
+
+    // Stage B.1 cell k of every series: markers count with height <= value (upper_bound index),
+    //    MIN and MAX markers are set, new MIN falls into cell 1
+    double k[W];
+    for (size_t l=0; l<VECTOR_SERIES; l+=P2Lanes::width) {
+        locate<P2Lanes>(values, k, l);
+    }
+    for (size_t l=VECTOR_SERIES; l<W; ++l) {
+        locate<P2ScalarLanes>(values, k, l);
+    }
+
+    // Stage B.3-4 as in P2::add, marker i is adjusted before marker i+1 position is incremented
+    for (size_t i=1; i<markerCount_ - 1; ++i) {
+        desiredPositions_[i] += increments_[i];
+        for (size_t l=0; l<VECTOR_SERIES; l+=P2Lanes::width) {
+            adjust<P2Lanes>(i, k, l);
+        }
+        for (size_t l=VECTOR_SERIES; l<W; ++l) {
+            adjust<P2ScalarLanes>(i, k, l);
+        }
+    }
+    desiredPositions_[markerCount_ - 1] += 1;
+    double* nmax = &positions_[(markerCount_ - 1)*W];
+    for (size_t l=0; l<W; ++l) {
+        nmax[l] += 1;
+    }
+}
+
+template <size_t W> double P2Batch<W>::quantile(size_t series, size_t qindex) const
+{
+    if ((qindex > qcount_) || (series >= W)) {
+        return 0;
+    }
+    return heights_[(qindex*2 + 2)*W + series];
+}
+
+template <size_t W> double P2Batch<W>::count() const
+{
+    if (!valid()) {
+        return markerCount_ - valuesLeftForInit_;
+    }
+    return positions_[(markerCount_ - 1)*W];
+}
+
+} // namespace rtstat
@@ -0,0 +1,409 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include "rollup.hpp"
+
+namespace rtstat {
+
+static const uint32_t FILE_MAGIC = 0x52535452; // "RTSR"
+static const uint32_t FILE_VERSION = 1;
+static const int64_t NO_TIME = std::numeric_limits<int64_t>::min();
+
+static inline int64_t alignDown(int64_t timestamp, int64_t resolution)
+{
+    int64_t start = timestamp - timestamp % resolution;
+    return (start > timestamp) ? start - resolution : start;
+}
+
+Rollup::Rollup(const std::vector<Rollup::Tier>& tiers, size_t delta, size_t excessiveGrowthPCT)
+    : tiers_(tiers), delta_(delta), excessiveGrowthPCT_(excessiveGrowthPCT), stopping_(false)
+{
+    if (tiers_.empty()) {
+        tiers_ = defaultTiers();
+    }
+}
+
+std::vector<Rollup::Tier> Rollup::defaultTiers()
+{
+    std::vector<Tier> tiers;
+    tiers.push_back(Tier(10, 360));
+    tiers.push_back(Tier(60, 1440));
+    tiers.push_back(Tier(3600, 720));
+    tiers.push_back(Tier(86400, 365));
+    return tiers;
+}
+
+Rollup::Series& Rollup::series(const std::string& key)
+{
+    auto found = series_.find(key);
+    if (found == series_.end()) {
+        Series& series = series_[key];
+        series.buckets.resize(tiers_.size());
+        series.rolled.assign(tiers_.size(), NO_TIME);
+        series.dropped.assign(tiers_.size(), NO_TIME);
+        return series;
+    }
+    return found->second;
+}
+
+TDigest& Rollup::bucket(Rollup::Series& series, size_t tier, int64_t timestamp)
+{
+    int64_t start = alignDown(timestamp, tiers_[tier].resolution);
+    auto found = series.buckets[tier].find(start);
+    if (found == series.buckets[tier].end()) {
+        found = series.buckets[tier].insert(std::make_pair(start, TDigest(delta_, excessiveGrowthPCT_))).first;
+    }
+    return found->second;
+}
+
+void Rollup::add(const std::string& key, int64_t timestamp, double value)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    Series& s = series(key);
+    bucket(s, 0, timestamp).add(value);
+    // late observation of already rolled up bucket
+    for (size_t i=1; (i<tiers_.size()) && (timestamp < s.rolled[i]); ++i) {
+        bucket(s, i, timestamp).add(value);
+    }
+}
+
+void Rollup::add(const std::string& key, int64_t timestamp, const TDigest::View& digest)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    Series& s = series(key);
+    bucket(s, 0, timestamp).merge(digest);
+    for (size_t i=1; (i<tiers_.size()) && (timestamp < s.rolled[i]); ++i) {
+        bucket(s, i, timestamp).merge(digest);
+    }
+}
+
+void Rollup::compact(int64_t now)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto it=series_.begin(); it!=series_.end(); ++it) {
+        Series& s = it->second;
+        // buckets of tier i - 1 starting before closed are complete
+        int64_t closed = alignDown(now, tiers_[0].resolution);
+        for (size_t i=1; i<tiers_.size(); ++i) {
+            std::map<int64_t, TDigest>& finer = s.buckets[i - 1];
+            auto bucketIt = (s.rolled[i] == NO_TIME) ? finer.begin() : finer.lower_bound(s.rolled[i]);
+            for (; (bucketIt != finer.end()) && (bucketIt->first < closed); ++bucketIt) {
+                bucket(s, i, bucketIt->first).merge(bucketIt->second);
+            }
+            s.rolled[i] = closed;
+            closed = alignDown(closed, tiers_[i].resolution);
+        }
+
+        // expired buckets are dropped only if they are merged into complete bucket of coarser tier
+        for (size_t i=0; i<tiers_.size(); ++i) {
+            int64_t resolution = tiers_[i].resolution;
+            int64_t expired = alignDown(now, resolution) - static_cast<int64_t>(tiers_[i].retention)*resolution;
+            if (i + 1 < tiers_.size()) {
+                expired = std::min(expired, alignDown(s.rolled[i + 1], tiers_[i + 1].resolution));
+            }
+            std::map<int64_t, TDigest>& buckets = s.buckets[i];
+            while (!buckets.empty() && (buckets.begin()->first < expired)) {
+                buckets.erase(buckets.begin());
+            }
+            s.dropped[i] = std::max(s.dropped[i], expired);
+        }
+    }
+}
+
+void Rollup::start(size_t intervalMs)
+{
+    stop();
+    stopping_ = false;
+    compactor_ = std::thread([this, intervalMs]() {
+        std::unique_lock<std::mutex> guard(wakeLock_);
+        while (!stopping_) {
+            wake_.wait_for(guard, std::chrono::milliseconds(intervalMs));
+            if (!stopping_) {
+                compact(time(NULL));
+            }
+        }
+    });
+}
+
+void Rollup::stop()
+{
+    if (compactor_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(wakeLock_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        compactor_.join();
+    }
+}
+
+// complete buckets of tier inside [from, to) are used, buckets on range edges and the range part
+//    not rolled up into the tier yet are covered by the finer tier
+void Rollup::cover(const Rollup::Series& s, size_t tier, int64_t from, int64_t to, std::vector<TDigest::View>& views) const
+{
+    if (from >= to) {
+        return;
+    }
+    int64_t resolution = tiers_[tier].resolution;
+    const std::map<int64_t, TDigest>& buckets = s.buckets[tier];
+    // buckets of tier starting before complete are rolled up entirely
+    int64_t complete = to;
+    if (tier > 0) {
+        complete = (s.rolled[tier] == NO_TIME) ? from : std::min(to, alignDown(s.rolled[tier], resolution));
+    }
+
+    for (auto it=buckets.upper_bound(from - resolution); (it != buckets.end()) && (it->first < complete); ++it) {
+        int64_t start = it->first;
+        if ((tier == 0) || ((start >= from) && (start + resolution <= to))) {
+            views.push_back(it->second.view());
+            continue;
+        }
+        int64_t low = std::max(from, start);
+        int64_t high = std::min(to, start + resolution);
+        if (low >= s.dropped[tier - 1]) {
+            cover(s, tier - 1, low, high, views);
+        }
+        else {
+            views.push_back(it->second.view()); // finer buckets are dropped, range is widened to the bucket
+        }
+    }
+    if (tier > 0) {
+        cover(s, tier - 1, std::max(from, complete), to, views);
+    }
+}
+
+size_t Rollup::quantiles(const std::string& key, int64_t from, int64_t to, const double* q, double* result, size_t count, 
+    double* weight) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    auto found = series_.find(key);
+    if (found == series_.end()) {
+        std::fill(result, result + count, 0.0);
+        if (weight) {
+            *weight = 0.0;
+        }
+        return 0;
+    }
+    std::vector<TDigest::View> views;
+    cover(found->second, tiers_.size() - 1, alignDown(from, tiers_[0].resolution), to, views);
+    if (weight) {
+        *weight = 0.0;
+        for (auto it=views.begin(); it!=views.end(); ++it) {
+            *weight += it->totalWeight;
+        }
+    }
+    TDigest::quantiles(views.data(), views.size(), q, result, count);
+    return views.size();
+}
+
+size_t Rollup::bucketCount(size_t tier) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t count = 0;
+    for (auto it=series_.begin(); it!=series_.end(); ++it) {
+        count += it->second.buckets[tier].size();
+    }
+    return count;
+}
+
+// File layout (host byte order):
+//    magic, version, tier count, key count (uint32), key sizes (uint32) and keys,
+//    block of every tier:
+//        resolution (int64), bucket count, centroid count (uint64), rolled and dropped time of every key (int64),
+//        columns of buckets: key index (uint32), start (int64), centroid count (uint32), min, max, total weight,
+//        columns of centroids: values, weights
+template <typename T> static inline bool writeColumn(FILE* f, const std::vector<T>& column)
+{
+    return fwrite(column.data(), sizeof(T), column.size(), f) == column.size();
+}
+
+// column size is bounded by the rest of the file before allocation
+template <typename T> static inline bool readColumn(FILE* f, std::vector<T>& column, uint64_t size, long fileSize)
+{
+    long position = ftell(f);
+    if ((position < 0) || (size > static_cast<uint64_t>(fileSize - position)/sizeof(T))) {
+        return false;
+    }
+    column.resize(size);
+    return fread(column.data(), sizeof(T), size, f) == size;
+}
+
+template <typename T> static inline bool writeValue(FILE* f, T value)
+{
+    return fwrite(&value, sizeof(T), 1, f) == 1;
+}
+
+template <typename T> static inline bool readValue(FILE* f, T* value)
+{
+    return fread(value, sizeof(T), 1, f) == 1;
+}
+
+bool Rollup::save(const char* path) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = writeValue<uint32_t>(f, FILE_MAGIC) && writeValue<uint32_t>(f, FILE_VERSION) 
+        && writeValue<uint32_t>(f, tiers_.size()) && writeValue<uint32_t>(f, series_.size());
+    for (auto it=series_.begin(); ok && (it!=series_.end()); ++it) {
+        ok = writeValue<uint32_t>(f, it->first.size()) && (fwrite(it->first.data(), 1, it->first.size(), f) == it->first.size());
+    }
+
+    std::vector<uint32_t> keys;
+    std::vector<int64_t> starts;
+    std::vector<uint32_t> counts;
+    std::vector<double> mins;
+    std::vector<double> maxs;
+    std::vector<double> weights;
+    std::vector<double> values;
+    std::vector<double> centroidWeights;
+    std::vector<int64_t> rolled;
+    std::vector<int64_t> dropped;
+    for (size_t tier=0; ok && (tier<tiers_.size()); ++tier) {
+        keys.clear(); starts.clear(); counts.clear(); mins.clear(); maxs.clear(); weights.clear();
+        values.clear(); centroidWeights.clear(); rolled.clear(); dropped.clear();
+        uint32_t key = 0;
+        for (auto it=series_.begin(); it!=series_.end(); ++it, ++key) {
+            rolled.push_back(it->second.rolled[tier]);
+            dropped.push_back(it->second.dropped[tier]);
+            const std::map<int64_t, TDigest>& buckets = it->second.buckets[tier];
+            for (auto bucketIt=buckets.begin(); bucketIt!=buckets.end(); ++bucketIt) {
+                TDigest::View view = bucketIt->second.view();
+                keys.push_back(key);
+                starts.push_back(bucketIt->first);
+                counts.push_back(view.count);
+                mins.push_back(view.min);
+                maxs.push_back(view.max);
+                weights.push_back(view.totalWeight);
+                for (size_t i=0; i<view.count; ++i) {
+                    values.push_back(view.centroids[i].value());
+                    centroidWeights.push_back(view.centroids[i].weight());
+                }
+            }
+        }
+        ok = writeValue<int64_t>(f, tiers_[tier].resolution) && writeValue<uint64_t>(f, keys.size()) 
+            && writeValue<uint64_t>(f, values.size()) && writeColumn(f, rolled) && writeColumn(f, dropped)
+            && writeColumn(f, keys) && writeColumn(f, starts) && writeColumn(f, counts)
+            && writeColumn(f, mins) && writeColumn(f, maxs) && writeColumn(f, weights)
+            && writeColumn(f, values) && writeColumn(f, centroidWeights);
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+bool Rollup::load(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    long fileSize = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+    uint32_t magic = 0, version = 0, tierCount = 0, keyCount = 0;
+    bool ok = (fileSize > 0) && (fseek(f, 0, SEEK_SET) == 0)
+        && readValue(f, &magic) && readValue(f, &version) && readValue(f, &tierCount) && readValue(f, &keyCount)
+        && (magic == FILE_MAGIC) && (version == FILE_VERSION) && (tierCount == tiers_.size())
+        && (keyCount <= static_cast<uint64_t>(fileSize)/sizeof(uint32_t));
+    std::vector<std::string> names;
+    std::vector<char> name;
+    for (uint32_t i=0; ok && (i<keyCount); ++i) {
+        uint32_t size = 0;
+        ok = readValue(f, &size) && readColumn(f, name, size, fileSize);
+        names.push_back(std::string(name.begin(), name.end()));
+    }
+
+    std::map<std::string, Series> loaded;
+    std::vector<Series*> series;
+    for (size_t i=0; ok && (i<names.size()); ++i) {
+        Series& s = loaded[names[i]];
+        s.buckets.resize(tiers_.size());
+        s.rolled.assign(tiers_.size(), NO_TIME);
+        s.dropped.assign(tiers_.size(), NO_TIME);
+        series.push_back(&s);
+    }
+
+    std::vector<uint32_t> keys;
+    std::vector<int64_t> starts;
+    std::vector<uint32_t> counts;
+    std::vector<double> mins;
+    std::vector<double> maxs;
+    std::vector<double> weights;
+    std::vector<double> values;
+    std::vector<double> centroidWeights;
+    std::vector<int64_t> rolled;
+    std::vector<int64_t> dropped;
+    std::vector<TDigest::WeightedPoint> centroids;
+    for (size_t tier=0; ok && (tier<tiers_.size()); ++tier) {
+        int64_t resolution = 0;
+        uint64_t bucketCount = 0;
+        uint64_t centroidCount = 0;
+        ok = readValue(f, &resolution) && readValue(f, &bucketCount) && readValue(f, &centroidCount)
+            && (resolution == tiers_[tier].resolution)
+            && readColumn(f, rolled, keyCount, fileSize) && readColumn(f, dropped, keyCount, fileSize)
+            && readColumn(f, keys, bucketCount, fileSize) && readColumn(f, starts, bucketCount, fileSize) 
+            && readColumn(f, counts, bucketCount, fileSize) && readColumn(f, mins, bucketCount, fileSize) 
+            && readColumn(f, maxs, bucketCount, fileSize) && readColumn(f, weights, bucketCount, fileSize)
+            && readColumn(f, values, centroidCount, fileSize) && readColumn(f, centroidWeights, centroidCount, fileSize);
+        for (size_t i=0; ok && (i<keyCount); ++i) {
+            series[i]->rolled[tier] = rolled[i];
+            series[i]->dropped[tier] = dropped[i];
+        }
+        size_t offset = 0;
+        for (size_t i=0; ok && (i<bucketCount); ++i) {
+            ok = (keys[i] < keyCount) && (offset + counts[i] <= centroidCount);
+            if (!ok || (counts[i] == 0)) {
+                continue;
+            }
+            centroids.resize(counts[i]);
+            for (size_t c=0; c<counts[i]; ++c) {
+                centroids[c].set(values[offset + c], centroidWeights[offset + c]);
+            }
+            offset += counts[i];
+            TDigest::View view(centroids.data(), centroids.size(), mins[i], maxs[i], weights[i]);
+            ok = view.valid(); // merge() of corrupted centroids may overrun T-digest buffer
+            if (ok) {
+                TDigest& digest = bucket(*series[keys[i]], tier, starts[i]);
+                if ((digest.view().count > 0) || !digest.restore(view)) {
+                    digest.merge(view); // duplicated bucket or other delta
+                }
+            }
+        }
+        ok = ok && (offset == centroidCount);
+    }
+    fclose(f);
+
+    if (ok) {
+        std::lock_guard<std::mutex> guard(lock_);
+        series_.swap(loaded);
+    }
+    return ok;
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "tdigest.hpp"
+
+namespace rtstat
+{
+
+// Multi-resolution time series of T-digests per key (e.g. 10 s, 1 min, 1 h, 1 day buckets).
+//    Observations and digests are added into the finest tier, compact() merges closed buckets of every tier
+//    into the next coarser one and drops buckets beyond tier retention. Quantiles over a time range
+//    combine the minimal set of complete buckets, coarse ones inside the range and finer ones on its edges,
+//    with virtual merge (TDigest::quantiles()). Tiers are saved into columnar file with one block per tier.
+class Rollup
+{
+    public:
+        class Tier {
+            public:
+                Tier(int64_t resolution, size_t retention): resolution(resolution), retention(retention) {};
+
+                int64_t resolution; // bucket duration (s), multiple of the finer tier resolution
+                size_t retention; // buckets kept
+        };
+
+        // tiers from the finest, resolutions must be multiples of each other
+        explicit Rollup(const std::vector<Tier>& tiers, size_t delta = 100, size_t excessiveGrowthPCT = 150);
+        ~Rollup() { stop(); };
+
+        static std::vector<Tier> defaultTiers(); // 10 s for 1 h, 1 min for 1 day, 1 h for 30 days, 1 day for a year
+
+        void add(const std::string& key, int64_t timestamp, double value);
+        void add(const std::string& key, int64_t timestamp, const TDigest::View& digest); // digest of bucket
+
+        void compact(int64_t now); // merge closed buckets into coarser tiers and drop expired buckets
+        void start(size_t intervalMs); // compact() by wall clock in background thread
+        void stop();
+
+        // quantiles (ascending) over [from, to), range is aligned to the finest tier resolution,
+        //    weight (optional) is observations count of combined buckets, return count of combined buckets
+        size_t quantiles(const std::string& key, int64_t from, int64_t to, const double* q, double* result, size_t count, 
+            double* weight = NULL) const;
+
+        bool save(const char* path) const; // return false on failure
+        bool load(const char* path); // replaces series, return false on failure or format mismatch
+
+        size_t bucketCount(size_t tier) const; // buckets of tier over all keys
+
+    private:
+        class Series {
+            public:
+                std::vector<std::map<int64_t, TDigest> > buckets; // per tier: bucket start -> digest
+                std::vector<int64_t> rolled; // per tier: buckets of finer tier before this time are merged into tier
+                std::vector<int64_t> dropped; // per tier: buckets before this time are dropped
+        };
+
+        Rollup(const Rollup&);
+        Rollup& operator=(const Rollup&);
+
+        Series& series(const std::string& key);
+        TDigest& bucket(Series& series, size_t tier, int64_t timestamp);
+        void cover(const Series& series, size_t tier, int64_t from, int64_t to, std::vector<TDigest::View>& views) const;
+
+        std::vector<Tier> tiers_;
+        size_t delta_;
+        size_t excessiveGrowthPCT_;
+        std::map<std::string, Series> series_;
+        mutable std::mutex lock_;
+
+        std::thread compactor_;
+        std::mutex wakeLock_;
+        std::condition_variable wake_;
+        bool stopping_;
+};
+
+} // namespace rtstat
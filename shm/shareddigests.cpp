@@ -0,0 +1,250 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shareddigests.hpp"
+
+namespace rtstat {
+
+static const uint64_t SEGMENT_MAGIC = 0x3174736769647472ULL; // "rtdigst1"
+static const size_t READ_ATTEMPTS = 64; // attempts to copy slot before giving up on writer
+
+size_t SharedDigests::segmentSize(size_t slotCount, size_t capacity)
+{
+    return sizeof(Header) + slotCount*(sizeof(SlotHeader) + capacity*sizeof(TDigest::WeightedPoint));
+}
+
+bool SharedDigests::map(int fd, size_t size)
+{
+    void* segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+        return false;
+    }
+    segment_ = static_cast<Header*>(segment);
+    size_ = size;
+    return true;
+}
+
+bool SharedDigests::create(const char* name, size_t slotCount, size_t capacity)
+{
+    close();
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = segmentSize(slotCount, capacity);
+    if (ftruncate(fd, size) != 0) {
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    if (!map(fd, size)) {
+        shm_unlink(name);
+        return false;
+    }
+
+    // ftruncate() fills segment with zeros: all slots are free with even sequence
+    segment_->slotCount = slotCount;
+    segment_->capacity = capacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    segment_->magic = SEGMENT_MAGIC;
+    return true;
+}
+
+bool SharedDigests::open(const char* name)
+{
+    close();
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(Header))) {
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, st.st_size)) {
+        return false;
+    }
+    if ((segment_->magic != SEGMENT_MAGIC) || (segmentSize(segment_->slotCount, segment_->capacity) > size_)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SharedDigests::close()
+{
+    if (segment_) {
+        munmap(segment_, size_);
+        segment_ = NULL;
+        size_ = 0;
+    }
+}
+
+bool SharedDigests::remove(const char* name)
+{
+    return shm_unlink(name) == 0;
+}
+
+size_t SharedDigests::slotCount() const
+{
+    return segment_ ? segment_->slotCount : 0;
+}
+
+size_t SharedDigests::capacity() const
+{
+    return segment_ ? segment_->capacity : 0;
+}
+
+size_t SharedDigests::slotSize() const
+{
+    return sizeof(SlotHeader) + segment_->capacity*sizeof(TDigest::WeightedPoint);
+}
+
+SharedDigests::SlotHeader* SharedDigests::slot(size_t index) const
+{
+    return reinterpret_cast<SlotHeader*>(reinterpret_cast<char*>(segment_ + 1) + index*slotSize());
+}
+
+// empty slot content under seqlock, sequence may be left odd by writer which died while publishing
+void SharedDigests::clear(SharedDigests::SlotHeader* s)
+{
+    uint64_t sequence = s->sequence.load(std::memory_order_relaxed) | 1;
+    s->sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s->count = 0;
+    s->totalWeight = 0;
+    s->sequence.store(sequence + 1, std::memory_order_release);
+}
+
+int SharedDigests::acquire()
+{
+    uint64_t pid = static_cast<uint64_t>(getpid());
+    for (size_t i=0; i<slotCount(); ++i) {
+        uint64_t free = 0;
+        if (slot(i)->owner.compare_exchange_strong(free, pid)) {
+            return static_cast<int>(i);
+        }
+    }
+    // reclaim slots of processes which exited without release()
+    for (size_t i=0; i<slotCount(); ++i) {
+        uint64_t owner = slot(i)->owner.load();
+        if ((owner != 0) && (kill(static_cast<pid_t>(owner), 0) != 0) && (errno == ESRCH)
+            && slot(i)->owner.compare_exchange_strong(owner, pid)) {
+            clear(slot(i));
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void SharedDigests::release(size_t index)
+{
+    SlotHeader* s = slot(index);
+    clear(s);
+    s->owner.store(0);
+}
+
+bool SharedDigests::publish(size_t index, const TDigest& digest)
+{
+    TDigest::View view = digest.view();
+    if (view.count > segment_->capacity) {
+        return false;
+    }
+
+    SlotHeader* s = slot(index);
+    uint64_t sequence = s->sequence.load(std::memory_order_relaxed);
+    s->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(centroids(s), view.centroids, view.count*sizeof(TDigest::WeightedPoint));
+    s->count = view.count;
+    s->min = view.min;
+    s->max = view.max;
+    s->totalWeight = view.totalWeight;
+    s->sequence.store(sequence + 2, std::memory_order_release);
+    return true;
+}
+
+// seqlock read: data is copied between two equal even sequence values
+bool SharedDigests::read(size_t index, SharedDigests::Copy& copy) const
+{
+    SlotHeader* s = slot(index);
+    for (size_t attempt=0; attempt<READ_ATTEMPTS; ++attempt) {
+        if (s->owner.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        size_t count = std::min<uint64_t>(s->count, segment_->capacity);
+        copy.centroids.resize(count);
+        memcpy(copy.centroids.data(), centroids(s), count*sizeof(TDigest::WeightedPoint));
+        copy.min = s->min;
+        copy.max = s->max;
+        copy.totalWeight = s->totalWeight;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s->sequence.load(std::memory_order_relaxed) == sequence) {
+            if (!copy.view().valid()) {
+                invalid_.fetch_add(1);
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SharedDigests::collect(std::vector<SharedDigests::Copy>& copies) const
+{
+    size_t count = 0;
+    for (size_t i=0; i<slotCount(); ++i) {
+        if (copies.size() <= count) {
+            copies.resize(count + 1);
+        }
+        if (read(i, copies[count]) && !copies[count].centroids.empty()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+size_t SharedDigests::merge(TDigest& digest)
+{
+    size_t count = collect(copies_);
+    for (size_t i=0; i<count; ++i) {
+        digest.merge(copies_[i].view());
+    }
+    return count;
+}
+
+}
@@ -0,0 +1,122 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "tdigest.hpp"
+
+namespace rtstat
+{
+
+// T-digests of many processes in POSIX shared memory segment.
+//    Every process owns a slot of fixed-capacity centroids storage and publishes its T-digest into it
+//    under seqlock (sequence is odd while slot is written), aggregator copies consistent slots and merges them.
+//    Neither adding observations nor publishing does syscalls, publishing is a copy of centroids.
+class SharedDigests
+{
+    public:
+        class Copy { // consistent copy of a slot
+            public:
+                Copy(): min(0.0), max(0.0), totalWeight(0.0) {};
+
+                inline TDigest::View view() const { 
+                    return TDigest::View(centroids.data(), centroids.size(), min, max, totalWeight); 
+                };
+
+                std::vector<TDigest::WeightedPoint> centroids;
+                double min;
+                double max;
+                double totalWeight;
+        };
+
+        SharedDigests(): segment_(NULL), size_(0), invalid_(0) {};
+        ~SharedDigests() { close(); };
+
+        // segment size for slots of capacity centroids, capacity should be at least TDigest capacity:
+        //     delta + delta*excessiveGrowthPCT/100 + 2
+        static size_t segmentSize(size_t slotCount, size_t capacity);
+        bool create(const char* name, size_t slotCount, size_t capacity); // create and map segment, return false on failure
+        bool open(const char* name); // map existing segment, return false on failure
+        void close(); // unmap segment
+        static bool remove(const char* name); // unlink segment name, mapped segments stay valid
+
+        // writer side
+        // claim free slot for current process, slots of exited owners are reclaimed if there is no free one,
+        //    return slot index or -1 if there is no free slot
+        int acquire();
+        void release(size_t slot); // free slot, its T-digest is not aggregated anymore
+        // copy T-digest into owned slot, return false if centroids count exceeds capacity,
+        //    values pending in incremental mode are not published
+        bool publish(size_t slot, const TDigest& digest);
+
+        // aggregator side
+        // consistent copy of slot, return false if slot is free, kept being written or its copy is not valid digest
+        //    (slots are written by other processes, invalid copy would overrun centroids buffer in merge())
+        bool read(size_t slot, Copy& copy) const;
+        size_t collect(std::vector<Copy>& copies) const; // copies of all owned slots, return count of copies
+        size_t merge(TDigest& digest); // merge all owned slots into T-digest, return count of merged slots
+
+        size_t slotCount() const;
+        size_t capacity() const;
+        size_t invalidCount() const { return invalid_.load(); }; // consistent copies skipped as invalid digests
+
+    private:
+        class Header { // segment header
+            public:
+                uint64_t magic;
+                uint64_t slotCount;
+                uint64_t capacity;
+        };
+
+        class SlotHeader { // followed by capacity centroids
+            public:
+                std::atomic<uint64_t> sequence; // odd while slot is written
+                std::atomic<uint64_t> owner; // process id of owner, 0 - slot is free
+                uint64_t count; // centroids count
+                double min;
+                double max;
+                double totalWeight;
+        };
+
+        SharedDigests(const SharedDigests&);
+        SharedDigests& operator=(const SharedDigests&);
+
+        bool map(int fd, size_t size);
+        void clear(SlotHeader* slot);
+        size_t slotSize() const;
+        SlotHeader* slot(size_t index) const;
+        inline TDigest::WeightedPoint* centroids(SlotHeader* slot) const { return reinterpret_cast<TDigest::WeightedPoint*>(slot + 1); };
+
+        Header* segment_;
+        size_t size_;
+        std::vector<Copy> copies_; // reused by merge()
+        mutable std::atomic<size_t> invalid_;
+};
+
+} // namespace rtstat
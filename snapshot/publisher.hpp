@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+namespace rtstat
+{
+
+// Publishing of immutable snapshots from single writer to many readers (RCU-like).
+//    Writer fills a slot that is neither current nor read and makes it current,
+//    readers pin the current slot with reference counter and read it while writer continues.
+//    Neither side waits for the other: reader retries only when a publish races its pinning,
+//    writer skips the publish when every other slot is still pinned by readers.
+template <class T, size_t SlotCount = 3> class Publisher
+{
+    static_assert(SlotCount >= 2, "publisher needs at least two slots");
+
+    private:
+        class Slot
+        {
+            public:
+                Slot(): readers(0) {};
+
+                T value;
+                std::atomic<size_t> readers;
+        };
+
+    public:
+        class Reader // pins the current snapshot for the reader lifetime
+        {
+            public:
+                explicit Reader(const Publisher& publisher)
+                {
+                    while (true) {
+                        size_t index = publisher.current_.load();
+                        slot_ = &publisher.slots_[index];
+                        slot_->readers.fetch_add(1);
+                        if (publisher.current_.load() == index) {
+                            break;
+                        }
+                        slot_->readers.fetch_sub(1);
+                    }
+                };
+                ~Reader() { slot_->readers.fetch_sub(1); };
+
+                inline const T& operator*() const { return slot_->value; };
+                inline const T* operator->() const { return &slot_->value; };
+            private:
+                Reader(const Reader&);
+                Reader& operator=(const Reader&);
+
+                Slot* slot_;
+        };
+
+        Publisher(): current_(0), version_(0) {};
+
+        // fill(T&) writes the snapshot into a free slot, return false if no slot was free
+        template <class F> bool publish(F fill)
+        {
+            size_t current = current_.load();
+            for (size_t i=1; i<SlotCount; ++i) {
+                size_t index = (current + i) % SlotCount;
+                if (slots_[index].readers.load() == 0) {
+                    fill(slots_[index].value);
+                    current_.store(index);
+                    version_.fetch_add(1);
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        size_t version() const { return version_.load(); }; // count of published snapshots
+
+    private:
+        Publisher(const Publisher&);
+        Publisher& operator=(const Publisher&);
+
+        mutable Slot slots_[SlotCount];
+        std::atomic<size_t> current_;
+        std::atomic<size_t> version_;
+};
+
+} // namespace rtstat
@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include "taildigest.hpp"
+
+namespace rtstat {
+
+void TailDigest::describe(FILE * f) const
+{
+    sortTails();
+    fprintf(f, "count: %zu, top: %zu/%zu, bottom: %zu/%zu\n", count_, top_.size(), topSize_, bottom_.size(), bottomSize_);
+    if (!top_.empty()) {
+        fprintf(f, "top tail: [%f, %f]\n", top_.front(), top_.back());
+    }
+    if (!bottom_.empty()) {
+        fprintf(f, "bottom tail: [%f, %f]\n", bottom_.back(), bottom_.front());
+    }
+    body_.describe(f);
+}
+
+void TailDigest::addTop(double value)
+{
+    if (top_.size() < topSize_) {
+        top_.push_back(value);
+        std::push_heap(top_.begin(), top_.end(), std::greater<double>());
+        sorted_ = false;
+    }
+    else if (topSize_ && (value > top_.front())) {
+        std::pop_heap(top_.begin(), top_.end(), std::greater<double>());
+        top_.back() = value;
+        std::push_heap(top_.begin(), top_.end(), std::greater<double>());
+        sorted_ = false;
+    }
+}
+
+void TailDigest::addBottom(double value)
+{
+    if (bottom_.size() < bottomSize_) {
+        bottom_.push_back(value);
+        std::push_heap(bottom_.begin(), bottom_.end());
+        sorted_ = false;
+    }
+    else if (bottomSize_ && (value < bottom_.front())) {
+        std::pop_heap(bottom_.begin(), bottom_.end());
+        bottom_.back() = value;
+        std::push_heap(bottom_.begin(), bottom_.end());
+        sorted_ = false;
+    }
+}
+
+void TailDigest::add(double value)
+{
+    body_.add(value);
+    addTop(value);
+    addBottom(value);
+    ++count_;
+}
+
+size_t TailDigest::merge(const TailDigest& other)
+{
+    if ((topSize_ != other.topSize_) || (bottomSize_ != other.bottomSize_)) {
+        return 0;
+    }
+    if (&other == this) {
+        // addTop() and addBottom() push into heaps that are iterated as other
+        TailDigest copy(*this);
+        return merge(copy);
+    }
+
+    body_.merge(other.body_);
+    // extreme K values of the union are among extreme K values of both sides,
+    //    heaps of small side hold the same values, so each heap is merged only into its own
+    for (auto it=other.top_.begin(); it!=other.top_.end(); ++it) {
+        addTop(*it);
+    }
+    for (auto it=other.bottom_.begin(); it!=other.bottom_.end(); ++it) {
+        addBottom(*it);
+    }
+    count_ += other.count_;
+
+    return other.count_;
+}
+
+void TailDigest::sortTails() const
+{
+    if (sorted_) {
+        return;
+    }
+    std::sort(top_.begin(), top_.end());
+    std::sort(bottom_.begin(), bottom_.end(), std::greater<double>());
+    sorted_ = true;
+}
+
+double TailDigest::quantile(double q) const
+{
+    if (count_ == 0) {
+        return 0.0;
+    }
+
+    // rank of observation as index in sorted observations
+    size_t rank = (q <= 0.0) ? 0 : std::min(static_cast<size_t>(q*count_), count_ - 1);
+    if (rank >= count_ - top_.size()) {
+        sortTails();
+        return top_[rank - (count_ - top_.size())];
+    }
+    if (rank < bottom_.size()) {
+        sortTails();
+        return bottom_[bottom_.size() - 1 - rank];
+    }
+    return body_.quantile(q);
+}
+
+double TailDigest::min() const
+{
+    return quantile(0.0);
+}
+
+double TailDigest::max() const
+{
+    return quantile(1.0);
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+#include "tdigest.hpp"
+
+namespace rtstat
+{
+
+// T-digest body with exact tails: top-K (and optionally bottom-K) observations are kept in bounded heaps
+//    next to the T-digest, quantile() answers from the heap when the rank falls into the tail.
+//    Heaps keep exact K extreme values of all observations, so merging stays exact for the tail.
+//    Heaps are sorted by the first query after an update, so const methods are not safe for concurrent readers
+//    (unlike TDigest), readers must hold a lock or query their own copy.
+class TailDigest
+{
+    public:
+        explicit TailDigest(size_t top = 100, size_t bottom = 0, size_t delta = 100, size_t excessiveGrowthPCT = 150)
+            // top, bottom - count of extreme observations kept exactly
+            : body_(delta, excessiveGrowthPCT), topSize_(top), bottomSize_(bottom), count_(0), sorted_(true)
+        {
+            top_.reserve(topSize_);
+            bottom_.reserve(bottomSize_);
+        };
+
+        void add(double value);
+        // add observation values of any arithmetic type
+        template <typename InputIt> void add(InputIt begin, InputIt end);
+        template <typename T> void add(const T* values, size_t count) { add(values, values + count); };
+        // merging estimation with the same tail sizes, return count of merged observations
+        size_t merge(const TailDigest& other);
+
+        double quantile(double q) const;
+        double min() const;
+        double max() const;
+        inline size_t count() const { return count_; }; // observations count
+        inline const TDigest& body() const { return body_; };
+
+        void describe(FILE * f) const;
+
+    private:
+        void addTop(double value);
+        void addBottom(double value);
+        void sortTails() const; // sorted tails are still valid heaps
+
+        TDigest body_; // all observations, tails included
+        size_t topSize_;
+        size_t bottomSize_;
+        size_t count_;
+        mutable std::vector<double> top_; // min-heap of the largest observations, ascending when sorted
+        mutable std::vector<double> bottom_; // max-heap of the smallest observations, descending when sorted
+        mutable bool sorted_;
+};
+
+template <typename InputIt> void TailDigest::add(InputIt begin, InputIt end)
+{
+    static_assert(std::is_arithmetic<typename std::iterator_traits<InputIt>::value_type>::value, "T-digest values must be of arithmetic type");
+    for (InputIt it=begin; it!=end; ++it) {
+        add(static_cast<double>(*it));
+    }
+}
+
+} // namespace rtstat
@@ -26,14 +26,67 @@ SOFTWARE.
 #include <algorithm>
 #include <vector>
 #include <math.h>
+#include <cmath>
 
 #include "tdigest.hpp"
 
 namespace rtstat
 {
 
+TDigestBase::TDigestBase(const TDigestBase& other)
+    : min_(other.min_), max_(other.max_), centroidCount_(other.centroidCount_), totalWeight_(other.totalWeight_),
+    delta_(other.delta_), excessiveGrowthPCT_(other.excessiveGrowthPCT_), compactionStep_(other.compactionStep_),
+    compaction_(other.compaction_), pendingHead_(other.pendingHead_), arena_(other.arena_)
+{
+    centroids_.assign(other.centroids_.begin(), other.centroids_.end(), arena_);
+    compacted_.assign(other.compacted_.begin(), other.compacted_.end(), arena_);
+    pending_.reserve(other.pending_.capacity(), arena_); // pending values are added while size is below capacity
+    pending_.assign(other.pending_.begin(), other.pending_.end(), arena_);
+}
+
+// buffers are taken from other, which is left without centroids and may only be destroyed or assigned
+TDigestBase::TDigestBase(TDigestBase&& other)
+    : min_(other.min_), max_(other.max_), centroidCount_(other.centroidCount_), totalWeight_(other.totalWeight_),
+    delta_(other.delta_), excessiveGrowthPCT_(other.excessiveGrowthPCT_), compactionStep_(other.compactionStep_),
+    compaction_(other.compaction_), pendingHead_(other.pendingHead_), arena_(other.arena_)
+{
+    centroids_.swap(other.centroids_);
+    compacted_.swap(other.compacted_);
+    pending_.swap(other.pending_);
+    spill_.swap(other.spill_);
+    other.centroidCount_ = 0;
+    other.pendingHead_ = 0;
+}
+
+TDigestBase& TDigestBase::operator=(TDigestBase other)
+{
+    centroids_.swap(other.centroids_);
+    compacted_.swap(other.compacted_);
+    pending_.swap(other.pending_);
+    spill_.swap(other.spill_);
+    std::swap(arena_, other.arena_); // other releases old buffers with their arena
+    min_ = other.min_;
+    max_ = other.max_;
+    centroidCount_ = other.centroidCount_;
+    totalWeight_ = other.totalWeight_;
+    delta_ = other.delta_;
+    excessiveGrowthPCT_ = other.excessiveGrowthPCT_;
+    compactionStep_ = other.compactionStep_;
+    compaction_ = other.compaction_;
+    pendingHead_ = other.pendingHead_;
+    return *this;
+}
+
+TDigestBase::~TDigestBase()
+{
+    centroids_.release(arena_);
+    compacted_.release(arena_);
+    pending_.release(arena_);
+    spill_.release(arena_);
+}
+
 // Scaling function from folly TDigest
-static double scalingK(double q, double d) {
+double TDigestBase::scalingK(double q, double d) {
     if (q >= 0.5) {
         return d - d * sqrt(0.5 - 0.5 * q);
     }
@@ -41,7 +94,7 @@ static double scalingK(double q, double d) {
 }
 
 // Inverse scaling function from folly TDigest
-static double scalingKInverse(double k, double d) {
+double TDigestBase::scalingKInverse(double k, double d) {
     double k_div_d = k / d;
     if (k_div_d >= 0.5) {
         double base = 1 - k_div_d;
@@ -51,7 +104,7 @@ static double scalingKInverse(double k, double d) {
     }
 }
 
-void TDigest::describe(FILE * f) const
+void TDigestBase::describe(FILE * f) const
 {
     fprintf(f, "\ncentroids: %d, min:%f, max:%f\n       value     weight\n", centroidCount_, min_, max_);
     for (size_t i=0; i<centroidCount_; ++i) {
@@ -59,18 +112,18 @@ void TDigest::describe(FILE * f) const
     }
 }
 
-void TDigest::add(double value) {
+void TDigestBase::add(double value) {
     clusteringAdd(value, 1);
 }
 
-void TDigest::add(std::vector<TDigest::WeightedPoint> values) 
+void TDigestBase::add(const std::vector<TDigestBase::WeightedPoint>& values) 
 {
-    for (std::vector<TDigest::WeightedPoint>::iterator it=values.begin(); it!=values.end(); ++it) {
+    for (auto it=values.begin(); it!=values.end(); ++it) {
         clusteringAdd(it->value(), it->weight());
     }
 };
 
-double TDigest::weightLeft(size_t index) const
+double TDigestBase::weightLeft(size_t index) const
 {    
     if (index > centroidCount_/2) {
         // backward cummulative sum
@@ -90,7 +143,31 @@ double TDigest::weightLeft(size_t index) const
     }
 }
 
-inline void TDigest::clusteringAdd(double value, double weight) 
+void TDigestBase::clusteringAdd(double value, double weight) 
+{
+    if (compactionStep_) {
+        if (!compaction_.active && (pendingHead_ < pending_.size())) {
+            // drain one pending value per add
+            clusteringInsert(pending_[pendingHead_].value(), pending_[pendingHead_].weight());
+            if (++pendingHead_ == pending_.size()) {
+                pending_.clear();
+                pendingHead_ = 0;
+            }
+        }
+        if (compaction_.active) {
+            // centroids are frozen until compaction completes
+            if (pending_.size() < pending_.capacity()) {
+                pending_.push_back(TDigestBase::WeightedPoint(value, weight), arena_);
+                compactionContinue(compactionStep_);
+                return;
+            }
+            flush();
+        }
+    }
+    clusteringInsert(value, weight);
+}
+
+void TDigestBase::clusteringInsert(double value, double weight) 
 {
     if (centroidCount_ == 0) {
         min_ = value;
@@ -108,14 +185,14 @@ inline void TDigest::clusteringAdd(double value, double weight)
     // Find centroids with minimum distance to xn
     //      "To add a new value xn with a weight wn, the set of centroids is found that have minimum distance to xn."
     auto Z = std::upper_bound (centroids_.begin(), centroids_.begin() + centroidCount_, value,
-            [](const double a, const TDigest::WeightedPoint& b) { 
+            [](const double a, const TDigestBase::WeightedPoint& b) { 
             return a < b.value(); 
         }
     );
     size_t Z_index = (Z - centroids_.begin());
 
-    TDigest::WeightedPoint* left = NULL;
-    TDigest::WeightedPoint* right = NULL;
+    TDigestBase::WeightedPoint* left = NULL;
+    TDigestBase::WeightedPoint* right = NULL;
     if (Z_index == centroidCount_) {
         left = &centroids_[Z_index - 1];
     }
@@ -166,158 +243,127 @@ inline void TDigest::clusteringAdd(double value, double weight)
         centroids_[Z_index].set(value, weight);
         ++centroidCount_;
 
-        if (centroidCount_ == centroids_.size()) {
+        if (compactionStep_ && !compaction_.active && (centroidCount_ + 1 >= centroids_.size())) {
+            compactionStart();
+        }
+        else if (centroidCount_ == centroids_.size()) {
             shrink();
         }
     }
 }
 
-// merging sorted values into T-digest, return count of merged values
-size_t TDigest::merge(TDigest digest)
+void TDigestBase::compactionStart()
 {
-    if (digest.centroidCount_ == 0) {
-        return 0;
-    }
-
-    double value = 0;
-    double weight = 0;
-
-    totalWeight_ += digest.totalWeight_;
-
-    std::vector<TDigest::WeightedPoint> oldCentroids(centroids_.begin(), centroids_.begin() + centroidCount_);
-    auto it = oldCentroids.begin(); 
-    auto itAdd = digest.centroids_.begin();
-    auto addEnd = digest.centroids_.begin() + digest.centroidCount_; 
-    std::vector<TDigest::WeightedPoint>::iterator* least = ((centroidCount_ == 0) || (itAdd->value() < it->value())) ? &itAdd : &it;
-
-    double qlimit = scalingKInverse(1, delta_);
-
-    weight = (*least)->weight();
-    value = (*least)->value();
-    ++(*least);
-    min_ = value;
-    
-    double qleft = 0;
-    size_t newCentroidCount = 0;
-    while (true) {
-        double wi;
-        double vi;
-        if (itAdd != addEnd) {
-            if (it != oldCentroids.end()) {
-                least = (itAdd->value() < it->value()) ? &itAdd : &it;
-            } 
-            else {
-                least = &itAdd;
-            }
-        }
-        else if (it != oldCentroids.end()) {
-            least = &it;
-        }
-        else {
-            max_ = value;
-            break;
-        }
-
-        wi = (*least)->weight();
-        vi = (*least)->value();
-        ++(*least);        
+    compaction_.active = true;
+    compaction_.read = 1;
+    compaction_.write = 0;
+    compaction_.current.set(centroids_[0]);
+    compaction_.qleft = 0;
+    compaction_.qlimit = scalingKInverse(1, delta_);
+}
 
-        double q = qleft + (weight + wi)/totalWeight_;
-        if (q <= qlimit) {
+// the same as shrink(), but limited to steps centroids and writing into compacted_
+void TDigestBase::compactionContinue(size_t steps)
+{
+    double weight = compaction_.current.weight();
+    double value = compaction_.current.value();
+    size_t end = std::min(compaction_.read + steps, centroidCount_);
+    for (size_t i=compaction_.read; i < end; ++i) {        
+        double wi = centroids_[i].weight();
+        double vi = centroids_[i].value();
+        double q = compaction_.qleft + (weight + wi)/totalWeight_;
+        if (q <= compaction_.qlimit) {
             weight += wi;
             value += wi*(vi - value)/weight;
         }
         else {
-            centroids_[newCentroidCount].set(value, weight);
-            qleft += weight/totalWeight_;
-            ++newCentroidCount;
-            qlimit = scalingKInverse(newCentroidCount + 1, delta_);
+            compacted_[compaction_.write].set(value, weight);
+            compaction_.qleft += weight/totalWeight_;
+            ++compaction_.write;
+            compaction_.qlimit = scalingKInverse(compaction_.write + 1, delta_);
             weight = wi;
             value = vi;
         }
     }
-    centroids_[newCentroidCount].set(value, weight);
-    centroidCount_ = newCentroidCount + 1;
+    compaction_.read = end;
+
+    if (end < centroidCount_) {
+        compaction_.current.set(value, weight);
+        return;
+    }
+    compacted_[compaction_.write].set(value, weight);
+    centroids_.swap(compacted_);
+    centroidCount_ = compaction_.write + 1;
+    compaction_.active = false;
 }
 
-// merging sorted values into T-digest, return count of merged values
-size_t TDigest::merge(std::vector<double>::iterator begin, std::vector<double>::iterator end)
+void TDigestBase::flush()
 {
-    if (begin == end) {
-        return 0;
+    while (true) {
+        if (compaction_.active) {
+            compactionContinue(centroidCount_);
+        }
+        if (pendingHead_ == pending_.size()) {
+            break;
+        }
+        clusteringInsert(pending_[pendingHead_].value(), pending_[pendingHead_].weight());
+        ++pendingHead_;
     }
+    pending_.clear();
+    pendingHead_ = 0;
+}
 
-    double value = 0;
-    double weight = 0;
-
-    // if vector is unsorted we stop earlier
-    std::vector<double>::iterator addEnd=begin;
-    while ((addEnd!=end) && (value <= *addEnd)) {
-        value = *addEnd;
-        ++addEnd;
+size_t TDigestBase::merge(const TDigestBase& digest)
+{
+    if (&digest == this) {
+        // merge output overwrites centroids_ that are read by view
+        TDigestBase copy(*this);
+        return merge(copy);
     }
-    totalWeight_ += addEnd - begin;
-
-    std::vector<TDigest::WeightedPoint> oldCentroids(centroids_.begin(), centroids_.begin() + centroidCount_);
-    auto it = oldCentroids.begin(); 
-    std::vector<double>::iterator itAdd = begin; 
-    if ((centroidCount_ == 0) || (*itAdd < it->value())) {
-        weight = 1; value = *itAdd; ++itAdd;
+    size_t count = merge(digest.view());
+    // values pending in incremental mode of merged T-digest
+    for (size_t i=digest.pendingHead_; i<digest.pending_.size(); ++i) {
+        clusteringAdd(digest.pending_[i].value(), digest.pending_[i].weight());
     }
-    else {
-        weight = it->weight(); value = it->value(); ++it;
+    return count + digest.pending_.size() - digest.pendingHead_;
+}
+
+bool TDigestBase::restore(const TDigestBase::View& view)
+{
+    if (view.count > centroids_.size()) {
+        return false;
     }
-    min_ = value;
+    flush();
+    std::copy(view.centroids, view.centroids + view.count, centroids_.begin());
+    centroidCount_ = view.count;
+    min_ = view.min;
+    max_ = view.max;
+    totalWeight_ = view.totalWeight;
+    return true;
+}
 
-    double qlimit = scalingKInverse(1, delta_);
-    double qleft = 0;
-    size_t newCentroidCount = 0;
-    while (true) {
-        double wi;
-        double vi;
-        if (itAdd != addEnd) {
-            if (it != oldCentroids.end()) {
-                if (*itAdd < it->value()) {
-                    wi = 1; vi = *itAdd; ++itAdd;
-                }
-                else {
-                    wi = it->weight(); vi = it->value(); ++it;
-                }
-            } 
-            else {
-                wi = 1; vi = *itAdd; ++itAdd;
-            }
-        }
-        else if (it != oldCentroids.end()) {
-            wi = it->weight(); vi = it->value(); ++it;
-        }
-        else {
-            max_ = value;
-            break;
-        }
+// merging sorted centroids into T-digest, return count of merged centroids
+size_t TDigestBase::merge(const TDigestBase::View& view)
+{
+    if (view.count == 0) {
+        return 0;
+    }
+    flush();
 
-        double q = qleft + (weight + wi)/totalWeight_;
-        if (q <= qlimit) {
-            weight += wi;
-            value += wi*(vi - value)/weight;
-        }
-        else {
-            centroids_[newCentroidCount].set(value, weight);
-            qleft += weight/totalWeight_;
-            ++newCentroidCount;
-            qlimit = scalingKInverse(newCentroidCount + 1, delta_);
-            weight = wi;
-            value = vi;
-        }
-    }    
-    centroids_[newCentroidCount].set(value, weight);
-    centroidCount_ = newCentroidCount + 1;
+    totalWeight_ += view.totalWeight;
+    min_ = (centroidCount_ == 0) ? view.min : std::min(min_, view.min);
+    max_ = (centroidCount_ == 0) ? view.max : std::max(max_, view.max);
+    mergeRun(CentroidValues(view.centroids), CentroidValues(view.centroids + view.count), CentroidWeights(view.centroids), 
+        view.count, view.totalWeight, view.centroids[0].value(), view.centroids[view.count - 1].value());
 
-    return addEnd - begin;
+    return view.count;
 }
 
-void TDigest::shrink() 
+void TDigestBase::shrink() 
 {        
+    if (compaction_.active) {
+        compactionContinue(centroidCount_);
+    }
     double qlimit = scalingKInverse(1, delta_);
     double weight = centroids_[0].weight();
     double value = centroids_[0].value();
@@ -345,7 +391,7 @@ void TDigest::shrink()
     centroidCount_ = newCentroidCount + 1;
 }
 
-double TDigest::quantile(double q) const 
+double TDigestBase::quantile(double q) const 
 {
     if (centroidCount_ == 0) {
         return 0.0;
@@ -406,4 +452,366 @@ double TDigest::quantile(double q) const
 }
 
 
+size_t TDigestBase::bytes() const
+{
+    return (centroids_.capacity() + compacted_.capacity() + pending_.capacity() + spill_.capacity())*sizeof(WeightedPoint);
+}
+
+bool TDigestBase::View::valid() const
+{
+    if (!std::isfinite(min) || !std::isfinite(max) || (min > max) || !std::isfinite(totalWeight) || (count && !centroids)) {
+        return false;
+    }
+    double sum = 0.0;
+    for (size_t i=0; i<count; ++i) {
+        double value = centroids[i].value();
+        double weight = centroids[i].weight();
+        if (!std::isfinite(value) || ((i > 0) && (value < centroids[i - 1].value())) || !std::isfinite(weight) || (weight <= 0.0)) {
+            return false;
+        }
+        sum += weight;
+    }
+    // total weight is accumulated by T-digest in other order
+    return fabs(sum - totalWeight) <= 1e-9*sum;
+}
+
+TDigestBase::View TDigestBase::view() const
+{
+    return TDigestBase::View(&centroids_[0], centroidCount_, min_, max_, totalWeight_);
+}
+
+// k-way walk over views centroids in ascending or descending order,
+//    views [0, size) are kept as binary heap by head value
+template <bool Descending> class ViewWalk
+{
+    public:
+        // drops empty views, resets cursors and builds heap, returns heap size
+        static size_t start(TDigestBase::View* views, size_t viewCount)
+        {
+            size_t size = 0;
+            for (size_t i=0; i<viewCount; ++i) {
+                if (views[i].count == 0) {
+                    continue;
+                }
+                std::swap(views[size], views[i]);
+                views[size].cursor = 0;
+                views[size].head = current(views[size]).value();
+                ++size;
+            }
+            for (size_t i=size/2; i>0; --i) {
+                siftDown(views, size, i - 1);
+            }
+            return size;
+        }
+
+        // visits the next centroid
+        static TDigestBase::WeightedPoint pop(TDigestBase::View* views, size_t* size)
+        {
+            TDigestBase::View& top = views[0];
+            TDigestBase::WeightedPoint point = current(top);
+            if (++top.cursor < top.count) {
+                top.head = current(top).value();
+            }
+            else {
+                std::swap(views[0], views[*size - 1]);
+                --(*size);
+            }
+            siftDown(views, *size, 0);
+            return point;
+        }
+
+    private:
+        static inline const TDigestBase::WeightedPoint& current(const TDigestBase::View& view)
+        {
+            return Descending ? view.centroids[view.count - 1 - view.cursor] : view.centroids[view.cursor];
+        }
+
+        static inline bool before(const TDigestBase::View& a, const TDigestBase::View& b)
+        {
+            return Descending ? (a.head > b.head) : (a.head < b.head);
+        }
+
+        static void siftDown(TDigestBase::View* views, size_t size, size_t i)
+        {
+            while (true) {
+                size_t first = i;
+                size_t left = 2*i + 1;
+                if ((left < size) && before(views[left], views[first])) { first = left; }
+                if ((left + 1 < size) && before(views[left + 1], views[first])) { first = left + 1; }
+                if (first == i) {
+                    return;
+                }
+                std::swap(views[i], views[first]);
+                i = first;
+            }
+        }
+};
+
+// totals of views
+static void viewTotals(const TDigestBase::View* views, size_t viewCount, double* min, double* max, double* totalWeight, size_t* centroidCount)
+{
+    bool first = true;
+    *totalWeight = 0;
+    *centroidCount = 0;
+    for (size_t i=0; i<viewCount; ++i) {
+        if (views[i].count == 0) {
+            continue;
+        }
+        if (first || (views[i].min < *min)) { *min = views[i].min; }
+        if (first || (views[i].max > *max)) { *max = views[i].max; }
+        first = false;
+        *totalWeight += views[i].totalWeight;
+        *centroidCount += views[i].count;
+    }
+}
+
+// the same interpolation as quantile() between centroid at pos and its neighbours
+static double interpolate(double rank, double t, const TDigestBase::WeightedPoint& curr, const TDigestBase::WeightedPoint* lower, 
+    const TDigestBase::WeightedPoint* upper, double min, double max)
+{
+    double delta = 0;
+    if (lower && upper) {
+        delta = (upper->value() - lower->value()) / 2;
+        min = lower->value();
+        max = upper->value();
+    } else if (upper) {
+        delta = upper->value() - curr.value();
+        max = upper->value();
+    } else if (lower) {
+        delta = curr.value() - lower->value();
+        min = lower->value();
+    }
+    double value = curr.value() + ((rank - t) / curr.weight() - 0.5) * delta;
+    return (value > max) ? max : ((value < min) ? min : value);
+}
+
+void TDigestBase::snapshot(TDigestBase::Snapshot& snapshot) const
+{
+    snapshot.centroids_.assign(centroids_.begin(), centroids_.begin() + centroidCount_);
+    snapshot.cumulative_.resize(centroidCount_ + 1);
+    double t = 0;
+    for (size_t i=0; i<centroidCount_; ++i) {
+        snapshot.cumulative_[i] = t;
+        t += centroids_[i].weight();
+    }
+    snapshot.cumulative_[centroidCount_] = t;
+    snapshot.min_ = min_;
+    snapshot.max_ = max_;
+    snapshot.totalWeight_ = totalWeight_;
+}
+
+TDigestBase::View TDigestBase::Snapshot::view() const
+{
+    return TDigestBase::View(centroids_.data(), centroids_.size(), min_, max_, totalWeight_);
+}
+
+double TDigestBase::Snapshot::quantile(double q) const
+{
+    size_t count = centroids_.size();
+    if (count == 0) {
+        return 0.0;
+    }
+    if (q <= 0.0) {
+        return min_;
+    }
+    if (q >= 1.0) {
+        return max_;
+    }
+
+    double rank = q * totalWeight_;
+    size_t pos;
+    if (q > 0.5) {
+        // the last centroid starting at or below rank
+        pos = std::upper_bound(cumulative_.begin(), cumulative_.begin() + count, rank) - cumulative_.begin();
+        pos = (pos > 0) ? pos - 1 : 0;
+    } else {
+        // the first centroid ending above rank
+        pos = std::upper_bound(cumulative_.begin() + 1, cumulative_.end(), rank) - (cumulative_.begin() + 1);
+        pos = std::min(pos, count - 1);
+    }
+    return interpolate(rank, cumulative_[pos], centroids_[pos], (pos > 0) ? &centroids_[pos - 1] : NULL,
+        (pos < count - 1) ? &centroids_[pos + 1] : NULL, min_, max_);
+}
+
+// centroids are visited once for all quantiles: from the bottom for q <= 0.5, from the top for q > 0.5
+void TDigestBase::quantiles(TDigestBase::View* views, size_t viewCount, const double* q, double* result, size_t count)
+{
+    double min = 0;
+    double max = 0;
+    double totalWeight;
+    size_t centroidCount;
+    viewTotals(views, viewCount, &min, &max, &totalWeight, &centroidCount);
+    if (centroidCount == 0) {
+        std::fill(result, result + count, 0.0);
+        return;
+    }
+
+    size_t middle = 0;
+    while ((middle < count) && (q[middle] <= 0.5)) {
+        ++middle;
+    }
+
+    if (middle > 0) {
+        size_t heapSize = ViewWalk<false>::start(views, viewCount);
+        TDigestBase::WeightedPoint prev;
+        TDigestBase::WeightedPoint curr = ViewWalk<false>::pop(views, &heapSize);
+        size_t pos = 0;
+        double t = 0;
+        for (size_t i=0; i<middle; ++i) {
+            if (q[i] <= 0.0) {
+                result[i] = min;
+                continue;
+            }
+            double rank = q[i] * totalWeight;
+            while ((rank >= t + curr.weight()) && (heapSize > 0)) {
+                t += curr.weight();
+                prev = curr;
+                curr = ViewWalk<false>::pop(views, &heapSize);
+                ++pos;
+            }
+            TDigestBase::WeightedPoint next(heapSize ? views[0].head : 0, 0);
+            result[i] = interpolate(rank, t, curr, (pos > 0) ? &prev : NULL, heapSize ? &next : NULL, min, max);
+        }
+    }
+
+    if (middle < count) {
+        size_t heapSize = ViewWalk<true>::start(views, viewCount);
+        TDigestBase::WeightedPoint next;
+        TDigestBase::WeightedPoint curr = ViewWalk<true>::pop(views, &heapSize);
+        size_t pos = centroidCount - 1;
+        double t = totalWeight - curr.weight();
+        for (size_t i=count; i>middle; --i) {
+            if (q[i - 1] >= 1.0) {
+                result[i - 1] = max;
+                continue;
+            }
+            double rank = q[i - 1] * totalWeight;
+            while ((rank < t) && (heapSize > 0)) {
+                next = curr;
+                curr = ViewWalk<true>::pop(views, &heapSize);
+                t -= curr.weight();
+                --pos;
+            }
+            TDigestBase::WeightedPoint prev(heapSize ? views[0].head : 0, 0);
+            result[i - 1] = interpolate(rank, t, curr, heapSize ? &prev : NULL, (pos < centroidCount - 1) ? &next : NULL, min, max);
+        }
+    }
+}
+
+// cumulative weight is interpolated linearly between centroids centers, min and max
+void TDigestBase::cdf(TDigestBase::View* views, size_t viewCount, const double* values, double* result, size_t count)
+{
+    double min = 0;
+    double max = 0;
+    double totalWeight;
+    size_t centroidCount;
+    viewTotals(views, viewCount, &min, &max, &totalWeight, &centroidCount);
+    if (centroidCount == 0) {
+        std::fill(result, result + count, 0.0);
+        return;
+    }
+
+    size_t heapSize = ViewWalk<false>::start(views, viewCount);
+    double leftValue = min;
+    double leftWeight = 0;
+    double t = 0;
+    TDigestBase::WeightedPoint curr = ViewWalk<false>::pop(views, &heapSize);
+    bool currValid = true;
+    for (size_t i=0; i<count; ++i) {
+        if (values[i] < min) {
+            result[i] = 0;
+            continue;
+        }
+        if (values[i] >= max) {
+            result[i] = 1;
+            continue;
+        }
+
+        while (currValid && (curr.value() <= values[i])) {
+            leftValue = curr.value();
+            leftWeight = t + curr.weight()/2;
+            t += curr.weight();
+            if (heapSize > 0) {
+                curr = ViewWalk<false>::pop(views, &heapSize);
+            }
+            else {
+                currValid = false;
+            }
+        }
+
+        double rightValue = currValid ? curr.value() : max;
+        double rightWeight = currValid ? t + curr.weight()/2 : totalWeight;
+        double weight = (rightValue > leftValue) ?
+            leftWeight + (rightWeight - leftWeight)*(values[i] - leftValue)/(rightValue - leftValue) : rightWeight;
+        result[i] = weight/totalWeight;
+    }
+}
+
+template <typename T> void BasicTDigest<T>::add(T value)
+{
+    observe(value, 1);
+    TDigestBase::add(static_cast<double>(value));
+}
+
+template <typename T> void BasicTDigest<T>::add(const std::vector<TDigestBase::WeightedPoint>& values)
+{
+    for (auto it=values.begin(); it!=values.end(); ++it) {
+        observe(static_cast<T>(it->value()), static_cast<Sum>(it->weight()));
+    }
+    TDigestBase::add(values);
+}
+
+template <typename T> size_t BasicTDigest<T>::merge(const BasicTDigest<T>& digest)
+{
+    if (!digest.empty_) {
+        if (empty_ || (digest.min_ < min_)) { min_ = digest.min_; }
+        if (empty_ || (digest.max_ > max_)) { max_ = digest.max_; }
+        sum_ += digest.sum_;
+        empty_ = false;
+    }
+    return TDigestBase::merge(digest);
+}
+
+// min and max of view are exact for T-digest of the same type, sum is estimated by centroids
+template <typename T> size_t BasicTDigest<T>::merge(const TDigestBase::View& view)
+{
+    if (view.count == 0) {
+        return 0;
+    }
+    double sum = 0;
+    for (size_t i=0; i<view.count; ++i) {
+        sum += view.centroids[i].value()*view.centroids[i].weight();
+    }
+    T min = static_cast<T>(view.min);
+    T max = static_cast<T>(view.max);
+    if (empty_ || (min < min_)) { min_ = min; }
+    if (empty_ || (max > max_)) { max_ = max; }
+    sum_ += std::is_integral<T>::value ? static_cast<Sum>(llround(sum)) : static_cast<Sum>(sum);
+    empty_ = false;
+    return TDigestBase::merge(view);
+}
+
+template <typename T> bool BasicTDigest<T>::restore(const TDigestBase::View& view)
+{
+    if (!TDigestBase::restore(view)) {
+        return false;
+    }
+    double sum = 0;
+    for (size_t i=0; i<view.count; ++i) {
+        sum += view.centroids[i].value()*view.centroids[i].weight();
+    }
+    min_ = static_cast<T>(view.min);
+    max_ = static_cast<T>(view.max);
+    sum_ = std::is_integral<T>::value ? static_cast<Sum>(llround(sum)) : static_cast<Sum>(sum);
+    empty_ = (view.count == 0);
+    return true;
+}
+
+template class BasicTDigest<double>;
+template class BasicTDigest<float>;
+template class BasicTDigest<int32_t>;
+template class BasicTDigest<uint32_t>;
+template class BasicTDigest<int64_t>;
+template class BasicTDigest<uint64_t>;
+
 }
\ No newline at end of file
@@ -24,17 +24,25 @@ SOFTWARE.
 
 #pragma once
 
+#include <stdint.h>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+#include "arena.hpp"
 
 namespace rtstat
 {
 
-class TDigest
+// T-digest centroids and algorithms on double values, ingestion is typed by BasicTDigest<T>
+class TDigestBase
 {
     public:  
         class WeightedPoint {            
             public:
                 WeightedPoint(): value_(0.0), weight_(0.0) {};
+                WeightedPoint(double value, double weight): value_(value), weight_(weight) {};
                 inline void add(double value, double weight) {
                     weight_ += weight;
                     value_ += weight*(value - value_)/weight_; // mean or mass center
@@ -56,33 +64,395 @@ class TDigest
                 double weight_;
         };
 
-        explicit TDigest(size_t delta = 100, size_t excessiveGrowthPCT = 150)
+        class View { // read-only view of T-digest centroids, also used as cursor of k-way walk
+            public:
+                View(): centroids(NULL), count(0), min(0.0), max(0.0), totalWeight(0.0), cursor(0), head(0.0) {};
+                View(const WeightedPoint* centroids, size_t count, double min, double max, double totalWeight)
+                    : centroids(centroids), count(count), min(min), max(max), totalWeight(totalWeight), cursor(0), head(0.0) {};
+
+                // centroids of untrusted source (network, file) are finite and ascending with positive weights
+                //    summing up to totalWeight, min <= max; merge() of invalid view may overrun centroids buffer
+                bool valid() const;
+
+                const WeightedPoint* centroids;
+                size_t count;
+                double min;
+                double max;
+                double totalWeight;
+
+                size_t cursor; // walk state: centroids visited
+                double head; // walk state: value of next centroid to visit
+        };
+
+        class Snapshot { // immutable copy of T-digest for concurrent readers, filled by TDigestBase::snapshot()
+            public:
+                Snapshot(): min_(0.0), max_(0.0), totalWeight_(0.0) {};
+
+                double quantile(double q) const; // the same estimation as TDigest::quantile() with binary search
+                View view() const;
+                inline double totalWeight() const { return totalWeight_; };
+            private:
+                friend class TDigestBase;
+
+                std::vector<WeightedPoint> centroids_;
+                std::vector<double> cumulative_; // weight of centroids before i, last item is total weight
+                double min_;
+                double max_;
+                double totalWeight_;
+        };
+
+        typedef ArenaArray<WeightedPoint> Centroids;
+
+        explicit TDigestBase(size_t delta = 100, size_t excessiveGrowthPCT = 150, size_t compactionStep = 0, Arena* arena = NULL)
             // excessive growth factor in hundreds - maxSize = delta + delta*excessiveGrowth/100
+            // compaction step - centroids compacted per add() in incremental mode, 0 - synchronous shrink(),
+            //     it is raised to the minimal step for which excessive growth room is enough
+            // arena - storage of centroids, NULL - heap
             : delta_(delta), excessiveGrowthPCT_(excessiveGrowthPCT), min_(0.0), max_(0.0),
-            centroidCount_(0), totalWeight_(0.0), centroids_(delta + delta*excessiveGrowthPCT/100 + 2) {};
-
-        size_t merge(TDigest digest);
-        // merging sorted values into T-digest, return count of merged values
-        size_t merge(std::vector<double>::iterator begin, std::vector<double>::iterator end);
+            centroidCount_(0), totalWeight_(0.0), compactionStep_(compactionStep), pendingHead_(0), arena_(arena)
+        {
+            centroids_.resize(delta + delta*excessiveGrowthPCT/100 + 2, arena_);
+            if (compactionStep_) {
+                // compaction leaves at most delta + 2 centroids, values pending while it runs
+                // must be drained (2 centroids per add) before centroids count grows back to capacity
+                size_t capacity = centroids_.size();
+                size_t room = (capacity > delta_ + 2) ? capacity - delta_ - 2 : 0;
+                size_t minStep = room ? 2*capacity/room + 1 : capacity;
+                compactionStep_ = std::max(compactionStep_, minStep);
+                compacted_.resize(capacity, arena_);
+                pending_.reserve(capacity, arena_);
+            }
+            compaction_.active = false;
+        };
+        TDigestBase(const TDigestBase& other); // copy is allocated from arena of other
+        TDigestBase(TDigestBase&& other);
+        TDigestBase& operator=(TDigestBase other);
+        ~TDigestBase();
 
         void shrink(); // shrink T-digest to target compress factor
-
-        void add(std::vector<WeightedPoint> values); // add unsorted observation values into T-digest using clustering algorythm
-        void add(double value); // add single observation value into T-digest using clustering algorythm
+        void flush(); // complete incremental compaction and add pending values, those are not visible to quantile() before
 
         double quantile(double q) const;
         void describe(FILE * f) const;
+        View view() const; // values pending in incremental mode are not included
+        size_t bytes() const; // memory of centroids buffers: centroids, incremental compaction and merge spill
+        void snapshot(Snapshot& snapshot) const; // copy into snapshot reusing its memory, pending values are not included
+
+        // Virtual merge of many T-digests: walks centroids of views with k-way heap without intermediate
+        // T-digest and memory allocation, views are used as cursors and reordered.
+        //    quantiles must be in ascending order, those above 0.5 are walked from the top
+        static void quantiles(View* views, size_t viewCount, const double* q, double* result, size_t count);
+        //    values must be in ascending order, result is fraction of total weight less or equal to value
+        static void cdf(View* views, size_t viewCount, const double* values, double* result, size_t count);
+    protected:
+        size_t merge(const TDigestBase& digest);
+        size_t merge(const View& view); // merging centroids view into T-digest, return count of merged centroids
+        bool restore(const View& view); // replace centroids by view as is, return false if view exceeds capacity
+        // merging sorted values of any arithmetic type into T-digest, return count of merged values
+        template <typename InputIt> size_t merge(InputIt begin, InputIt end);
+        template <typename InputIt, typename WeightIt> size_t merge(InputIt begin, InputIt end, WeightIt weights);
+        template <typename InputIt, typename WeightIt> void mergeRun(InputIt itAdd, InputIt addEnd, WeightIt weights, 
+            size_t count, double runWeight, double low, double high);
+
+        void add(const std::vector<WeightedPoint>& values); // add unsorted observation values into T-digest using clustering algorythm
+        void add(double value); // add single observation value into T-digest using clustering algorythm
+        // add unsorted observation values of any arithmetic type, weights are optional
+        template <typename T> void add(const T* values, size_t count);
+        template <typename T, typename W> void add(const T* values, const W* weights, size_t count);
     private:
-        inline void clusteringAdd(double value, double weight);
+        class UnitWeights { // weights iterator of unweighted values
+            public:
+                inline double operator*() const { return 1.0; };
+                inline UnitWeights& operator++() { return *this; };
+        };
+
+        class CentroidValues { // values iterator of centroids
+            public:
+                explicit CentroidValues(const WeightedPoint* point): point_(point) {};
+                inline double operator*() const { return point_->value(); };
+                inline CentroidValues& operator++() { ++point_; return *this; };
+                inline bool operator!=(const CentroidValues& other) const { return point_ != other.point_; };
+            private:
+                const WeightedPoint* point_;
+        };
+
+        class CentroidWeights { // weights iterator of centroids
+            public:
+                explicit CentroidWeights(const WeightedPoint* point): point_(point) {};
+                inline double operator*() const { return point_->weight(); };
+                inline CentroidWeights& operator++() { ++point_; return *this; };
+            private:
+                const WeightedPoint* point_;
+        };
+
+        class Compaction { // state of incremental shrink from centroids_ into compacted_
+            public:
+                bool active;
+                size_t read;
+                size_t write;
+                WeightedPoint current;
+                double qleft;
+                double qlimit;
+        };
+
+        void clusteringAdd(double value, double weight);
+        void clusteringInsert(double value, double weight);
+        void compactionStart();
+        void compactionContinue(size_t steps); // compact up to steps centroids
+        static double scalingK(double q, double d); // scaling function k(q)
+        static double scalingKInverse(double k, double d); // inverse scaling function q(k)
         double weightLeft(size_t index) const; // Wleft from T-Digest paper
 
-        std::vector<WeightedPoint> centroids_;
+        Centroids centroids_;
         double min_;
         double max_;
         size_t centroidCount_; // initialized centorids count
         double totalWeight_; // total weight or observations count N from T-Digest paper
         size_t delta_; // compress factor
         size_t excessiveGrowthPCT_; // excessive growth factor in hundreds - maxSize = delta_*excessiveGrowth_/100
+
+        size_t compactionStep_; // centroids compacted per add(), 0 - synchronous shrink()
+        Compaction compaction_;
+        Centroids compacted_; // compaction output, swapped with centroids_ on completion
+        Centroids pending_; // values added during compaction
+        size_t pendingHead_; // first pending value not added yet
+        Centroids spill_; // centroids overtaken by merge output
+        Arena* arena_; // storage of all centroids buffers, NULL - heap
 };
 
+template <typename T> void TDigestBase::add(const T* values, size_t count)
+{
+    static_assert(std::is_arithmetic<T>::value, "T-digest values must be of arithmetic type");
+    for (const T* it=values; it!=values + count; ++it) {
+        clusteringAdd(static_cast<double>(*it), 1);
+    }
+}
+
+template <typename T, typename W> void TDigestBase::add(const T* values, const W* weights, size_t count)
+{
+    static_assert(std::is_arithmetic<T>::value && std::is_arithmetic<W>::value, "T-digest values and weights must be of arithmetic type");
+    for (size_t i=0; i<count; ++i) {
+        clusteringAdd(static_cast<double>(values[i]), static_cast<double>(weights[i]));
+    }
+}
+
+// merging sorted values into T-digest, return count of merged values
+template <typename InputIt> size_t TDigestBase::merge(InputIt begin, InputIt end)
+{
+    return merge(begin, end, UnitWeights());
+}
+
+// merging sorted weighted values into T-digest, return count of merged values
+//    values are converted to double inside the merge loop, so no intermediate copy is made
+template <typename InputIt, typename WeightIt> size_t TDigestBase::merge(InputIt begin, InputIt end, WeightIt weights)
+{
+    static_assert(std::is_arithmetic<typename std::iterator_traits<InputIt>::value_type>::value, "T-digest values must be of arithmetic type");
+
+    if (begin == end) {
+        return 0;
+    }
+    flush();
+
+    // if values are unsorted we stop earlier
+    size_t count = 1;
+    double addWeight = *weights;
+    InputIt addEnd = begin;
+    double value = static_cast<double>(*addEnd);
+    WeightIt itWeight = weights;
+    for (++addEnd; (addEnd != end) && (value <= static_cast<double>(*addEnd)); ++addEnd) {
+        value = static_cast<double>(*addEnd);
+        addWeight += static_cast<double>(*(++itWeight));
+        ++count;
+    }
+    totalWeight_ += addWeight;
+    double addMin = static_cast<double>(*begin);
+    double addMax = value;
+
+    min_ = (centroidCount_ == 0) ? addMin : std::min(min_, addMin);
+    max_ = (centroidCount_ == 0) ? addMax : std::max(max_, addMax);
+    mergeRun(begin, addEnd, weights, count, addWeight, addMin, addMax);
+
+    return count;
+}
+
+// merging sorted run of count values into centroids in place, totalWeight_ (including runWeight), min_ and max_ are already updated.
+//    If the run fits into free capacity, only the window of centroids overlapped by the run [low, high]
+//    is compressed and centroids below and above it are kept as is, otherwise all centroids are compressed.
+//    Compressed centroids are moved to the buffer tail and merged forward into their place, so the output
+//    never overtakes unread centroids unless the run is larger than free capacity, then the rest is spilled.
+template <typename InputIt, typename WeightIt> void TDigestBase::mergeRun(InputIt itAdd, InputIt addEnd, WeightIt weights, 
+    size_t count, double runWeight, double low, double high)
+{
+    size_t first = 0;
+    size_t last = centroidCount_;
+    size_t k = 0; // scale index of the first output centroid
+    double qleft = 0;
+    if ((centroidCount_ > 0) && (centroidCount_ + count <= centroids_.size())) {
+        auto byValue = [](const double a, const WeightedPoint& b) { return a < b.value(); };
+        first = std::upper_bound(centroids_.begin(), centroids_.begin() + centroidCount_, low, byValue) - centroids_.begin();
+        last = std::upper_bound(centroids_.begin() + first, centroids_.begin() + centroidCount_, high, byValue) - centroids_.begin();
+        // weight below the window is summed from the shorter side
+        double weightLeft = 0;
+        if (first <= centroidCount_/2) {
+            for (size_t i=0; i<first; ++i) {
+                weightLeft += centroids_[i].weight();
+            }
+        }
+        else {
+            weightLeft = totalWeight_ - runWeight;
+            for (size_t i=first; i<centroidCount_; ++i) {
+                weightLeft -= centroids_[i].weight();
+            }
+        }
+        qleft = weightLeft/totalWeight_;
+        k = static_cast<size_t>(scalingK(qleft, delta_));
+    }
+
+    size_t suffix = centroidCount_ - last;
+    std::copy_backward(centroids_.begin() + first, centroids_.begin() + centroidCount_, centroids_.end());
+    WeightedPoint* it = &centroids_[0] + centroids_.size() - (centroidCount_ - first);
+    WeightedPoint* itEnd = it + (last - first);
+    WeightedPoint* out = &centroids_[first];
+
+    double weight = 0;
+    double value = 0;
+    if ((it == itEnd) || (static_cast<double>(*itAdd) < it->value())) {
+        weight = static_cast<double>(*weights); value = static_cast<double>(*itAdd); ++itAdd; ++weights;
+    }
+    else {
+        weight = it->weight(); value = it->value(); ++it;
+    }
+
+    // output is bounded by the buffer: totalWeight_ of a view may be slightly below the sum of weights, then q
+    //    passes 1 at the tail and every remaining item would be written as a centroid, it is merged into the last one
+    WeightedPoint* outLast = &centroids_[0] + centroids_.size() - suffix - 1; // written after the loop
+    size_t outCount = 0;
+    double qlimit = scalingKInverse(k + 1, delta_);
+    while (true) {
+        double wi;
+        double vi;
+        if (itAdd != addEnd) {
+            if ((it != itEnd) && (it->value() <= static_cast<double>(*itAdd))) {
+                wi = it->weight(); vi = it->value(); ++it;
+            } 
+            else {
+                wi = static_cast<double>(*weights); vi = static_cast<double>(*itAdd); ++itAdd; ++weights;
+            }
+        }
+        else if (it != itEnd) {
+            wi = it->weight(); vi = it->value(); ++it;
+        }
+        else {
+            break;
+        }
+
+        double q = qleft + (weight + wi)/totalWeight_;
+        if ((q <= qlimit) || (out >= outLast)) {
+            weight += wi;
+            value += wi*(vi - value)/weight;
+        }
+        else {
+            if ((out == it) && (it != itEnd)) {
+                spill_.assign(it, itEnd, arena_);
+                it = &spill_[0];
+                itEnd = it + spill_.size();
+            }
+            (out++)->set(value, weight);
+            qleft += weight/totalWeight_;
+            ++outCount;
+            qlimit = scalingKInverse(k + outCount + 1, delta_);
+            weight = wi;
+            value = vi;
+        }
+    }    
+    (out++)->set(value, weight);
+
+    std::copy(centroids_.end() - suffix, centroids_.end(), out);
+    centroidCount_ = (out - &centroids_[0]) + suffix;
+}
+
+// T-digest of observation values of type T. Centroids are double as interpolation requires it,
+//    min, max and sum of observations are kept exactly in T (sum in 64-bit integer for integer types).
+//    Instantiated for double, float, int32_t, uint32_t, int64_t and uint64_t.
+template <typename T> class BasicTDigest : public TDigestBase
+{
+    static_assert(std::is_arithmetic<T>::value, "T-digest values must be of arithmetic type");
+
+    public:
+        typedef typename std::conditional<std::is_integral<T>::value, 
+            typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type, double>::type Sum;
+
+        explicit BasicTDigest(size_t delta = 100, size_t excessiveGrowthPCT = 150, size_t compactionStep = 0, Arena* arena = NULL)
+            : TDigestBase(delta, excessiveGrowthPCT, compactionStep, arena), min_(0), max_(0), sum_(0), empty_(true) {};
+
+        size_t merge(const BasicTDigest& digest);
+        size_t merge(const View& view); // merging centroids view into T-digest, sum is estimated by centroids
+        // replace estimation by centroids saved from T-digest of the same configuration without compression,
+        //    return false if they exceed capacity
+        bool restore(const View& view);
+        // merging sorted values of any arithmetic type into T-digest, return count of merged values
+        template <typename InputIt> size_t merge(InputIt begin, InputIt end) { return merge(begin, end, UnitWeights()); };
+        template <typename InputIt, typename WeightIt> size_t merge(InputIt begin, InputIt end, WeightIt weights);
+        template <typename V> size_t merge(const V* values, size_t count) { return merge(values, values + count); };
+        template <typename V, typename W> size_t merge(const V* values, const W* weights, size_t count) { return merge(values, values + count, weights); };
+
+        void add(T value); // add single observation value into T-digest using clustering algorythm
+        void add(const std::vector<WeightedPoint>& values); // add unsorted weighted values
+        // add unsorted observation values of any arithmetic type, weights are optional
+        template <typename V> void add(const V* values, size_t count);
+        template <typename V, typename W> void add(const V* values, const W* weights, size_t count);
+
+        inline T min() const { return min_; }; // exact minimal observation
+        inline T max() const { return max_; }; // exact maximal observation
+        inline Sum sum() const { return sum_; }; // exact weighted sum of observations for integer weights
+
+    private:
+        class UnitWeights {
+            public:
+                inline int operator*() const { return 1; };
+                inline UnitWeights& operator++() { return *this; };
+        };
+
+        inline void observe(T value, Sum weight)
+        {
+            if (empty_ || (value < min_)) { min_ = value; }
+            if (empty_ || (value > max_)) { max_ = value; }
+            sum_ += static_cast<Sum>(value)*weight;
+            empty_ = false;
+        };
+
+        T min_;
+        T max_;
+        Sum sum_;
+        bool empty_;
+};
+
+template <typename T> template <typename V> void BasicTDigest<T>::add(const V* values, size_t count)
+{
+    for (const V* it=values; it!=values + count; ++it) {
+        observe(static_cast<T>(*it), 1);
+    }
+    TDigestBase::add(values, count);
+}
+
+template <typename T> template <typename V, typename W> void BasicTDigest<T>::add(const V* values, const W* weights, size_t count)
+{
+    for (size_t i=0; i<count; ++i) {
+        observe(static_cast<T>(values[i]), static_cast<Sum>(weights[i]));
+    }
+    TDigestBase::add(values, weights, count);
+}
+
+template <typename T> template <typename InputIt, typename WeightIt> size_t BasicTDigest<T>::merge(InputIt begin, InputIt end, WeightIt weights)
+{
+    size_t count = TDigestBase::merge(begin, end, weights);
+    // only sorted prefix is merged
+    for (size_t i=0; i<count; ++i, ++begin, ++weights) {
+        observe(static_cast<T>(*begin), static_cast<Sum>(*weights));
+    }
+    return count;
+}
+
+typedef BasicTDigest<double> TDigest;
+
 }
\ No newline at end of file
@@ -28,11 +28,27 @@ SOFTWARE.
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unistd.h>
+#include <sys/wait.h>
 
+#include "arena/arena.hpp"
 #include "p2/p2.hpp"
+#include "p2/lazyp2.hpp"
+#include "p2/p2batch.hpp"
 #include "tdigest/tdigest.hpp"
+#include "tdigest/taildigest.hpp"
+#include "snapshot/publisher.hpp"
+#include "shm/shareddigests.hpp"
+#include "metrics/metricset.hpp"
+#include "rollup/rollup.hpp"
+#include "verify/exactquantiles.hpp"
 
 #define SAMLPE_PASS_COUNT 5
+#define P2_MERGE_SHARDS 4
 
 class PerfReportItem {
     public:
@@ -46,6 +62,54 @@ class PerfReportItem {
         double time_stat_;
 };
 
+class LatencyReportItem {
+    public:
+        LatencyReportItem(const char* algorythm, size_t delta, size_t step, double mean, double p9999, double max)
+            : algorythm_(algorythm), delta_(delta), step_(step), mean_(mean), p9999_(p9999), max_(max) {};
+
+        std::string algorythm_;
+        size_t delta_;
+        size_t step_;
+        double mean_;
+        double p9999_;
+        double max_;
+};
+
+class RollupFileReportItem {
+    public:
+        RollupFileReportItem()
+            : digests_(0), ingest_ms_(0), file_size_(0), file_ms_(0), restored_(false), rejected_(0) {};
+
+        size_t digests_;
+        double ingest_ms_;
+        long file_size_;
+        double file_ms_;
+        bool restored_;
+        size_t rejected_;
+};
+
+class ConcurrencyReportItem {
+    public:
+        ConcurrencyReportItem(const char* algorythm, size_t readers, double write_ns, double read_ns, size_t reads)
+            : algorythm_(algorythm), readers_(readers), write_ns_(write_ns), read_ns_(read_ns), reads_(reads) {};
+
+        std::string algorythm_;
+        size_t readers_;
+        double write_ns_;
+        double read_ns_;
+        size_t reads_;
+};
+
+// exact quantiles of set from streaming verifier instead of sorted copy
+std::vector<double> exact_quantiles(const std::vector<double>& set, const std::vector<double>& quantiles)
+{
+    rtstat::ExactQuantiles verifier;
+    verifier.add(&set[0], set.size());
+    std::vector<double> result(quantiles.size());
+    verifier.quantiles(&quantiles[0], &result[0], quantiles.size());
+    return result;
+}
+
 void run_perf_test_p2(std::vector<double> set, std::vector<double> quantiles, double* msre, double* time_stat) 
 {
     rtstat::P2 p2(quantiles);
@@ -64,13 +128,12 @@ void run_perf_test_p2(std::vector<double> set, std::vector<double> quantiles, do
     //p2.describe(stdout);
     printf("=============\n");
 
-    std::vector<double> sset(set);
-    std::sort(sset.begin(), sset.end());
+    std::vector<double> exact = exact_quantiles(set, quantiles);
     double mse = 0;
     printf("   quantile          O        P^2\n");
     for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
         double qp = p2.quantile(it - quantiles.begin());
-        double qo = sset[(size_t) (sset.size()**it)];
+        double qo = exact[it - quantiles.begin()];
         mse += (qp -  qo)*(qp -  qo);
         printf(" %10.4f %10.4f %10.4f\n", *it, qo, qp );
     } 
@@ -80,6 +143,44 @@ void run_perf_test_p2(std::vector<double> set, std::vector<double> quantiles, do
     printf("== P2 =================\n\n");
 }
 
+void run_perf_test_p2_merge(std::vector<double> set, std::vector<double> quantiles, double* msre, double* time_stat) 
+{
+    std::vector<rtstat::P2> shards(P2_MERGE_SHARDS, rtstat::P2(quantiles));
+
+    printf("== P2 (M) =============\n");
+    size_t shard_size = (set.size() + P2_MERGE_SHARDS - 1)/P2_MERGE_SHARDS;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i=0; i<set.size(); ++i) {
+        shards[i/shard_size].add(set[i]);
+    } 
+    for (size_t i=1; i<P2_MERGE_SHARDS; ++i) {
+        shards[0].merge(shards[i]);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::chrono::duration<double, std::nano> per_ns = (end - start)/set.size();
+    *time_stat += per_ns.count();
+    printf("time spent (sec): %f, peritem (ns): %0.2f\n", diff, per_ns);
+
+    rtstat::P2& p2 = shards[0];
+    //p2.describe(stdout);
+    printf("=============\n");
+
+    std::vector<double> exact = exact_quantiles(set, quantiles);
+    double mse = 0;
+    printf("   quantile          O        P^2\n");
+    for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
+        double qp = p2.quantile(it - quantiles.begin());
+        double qo = exact[it - quantiles.begin()];
+        mse += (qp -  qo)*(qp -  qo);
+        printf(" %10.4f %10.4f %10.4f\n", *it, qo, qp );
+    } 
+
+    *msre = mse/quantiles.size();
+    printf("RMSE: %f\n", *msre);
+    printf("== P2 (M) =============\n\n");
+}
+
 void run_perf_test_tdigest(std::vector<double> set, std::vector<double> quantiles, double* msre, double* time_stat) 
 {
     rtstat::TDigest td(quantiles.size()*5, 200);
@@ -99,13 +200,12 @@ void run_perf_test_tdigest(std::vector<double> set, std::vector<double> quantile
     //td.describe(stdout);
     printf("=============\n");
 
-    std::vector<double> sset(set);
-    std::sort(sset.begin(), sset.end());
+    std::vector<double> exact = exact_quantiles(set, quantiles);
     double mse = 0;
     printf("   quantile          O   T-digest\n");
     for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
         double qp = td.quantile(*it);
-        double qo = sset[(size_t) (sset.size()**it)];
+        double qo = exact[it - quantiles.begin()];
         mse += (qp -  qo)*(qp -  qo);
         printf(" %10.4f %10.4f %10.4f\n", *it, qo, qp );
     } 
@@ -140,13 +240,12 @@ void run_perf_test_tdigest_merge(std::vector<double> set, std::vector<double> qu
     //td.describe(stdout);
     printf("=============\n");
 
-    std::vector<double> sset(set);
-    std::sort(sset.begin(), sset.end());
+    std::vector<double> exact = exact_quantiles(set, quantiles);
     double mse = 0;
     printf("   quantile          O   T-digest\n");
     for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
         double qp = td.quantile(*it);
-        double qo = sset[(size_t) (sset.size()**it)];
+        double qo = exact[it - quantiles.begin()];
         mse += (qp -  qo)*(qp -  qo);
         printf(" %10.4f %10.4f %10.4f\n", *it, qo, qp );
     } 
@@ -157,6 +256,738 @@ void run_perf_test_tdigest_merge(std::vector<double> set, std::vector<double> qu
     printf("== T-digest (M) =======\n\n");
 }
 
+// latency of individual add() calls, synchronous shrink() vs incremental compaction
+void run_latency_test_tdigest(std::vector<LatencyReportItem>& report, std::vector<double> set, size_t delta, size_t growth, size_t step) 
+{
+    rtstat::TDigest td(delta, growth, step);
+    std::vector<double> latency(set.size());
+
+    for (size_t i=0; i<set.size(); ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        td.add(set[i]);
+        auto end = std::chrono::high_resolution_clock::now();
+        latency[i] = std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    double mean = 0;
+    for (auto it=latency.begin(); it!=latency.end(); ++it) {
+        mean += *it;
+    }
+    mean /= latency.size();
+    std::sort(latency.begin(), latency.end());
+    report.push_back(LatencyReportItem(step ? "T-digest(I)" : "T-digest", delta, step, mean, latency[(size_t) (latency.size()*0.9999)], latency.back()));
+}
+
+// percentile histogram with many cells, P^2 vs lazy P^2
+template <class Estimator> void run_histogram_test(std::vector<PerfReportItem>& report, const char* algorythm, std::vector<double> set, size_t cells) 
+{
+    std::vector<double> quantiles = rtstat::LazyP2::cells(cells);
+    Estimator p2(quantiles);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto it=set.begin(); it!=set.end(); ++it) {
+        p2.add(*it);
+    } 
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = (end - start)/set.size();
+
+    std::vector<double> exact = exact_quantiles(set, quantiles);
+    double mse = 0;
+    for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
+        double qp = p2.quantile(it - quantiles.begin());
+        double qo = exact[it - quantiles.begin()];
+        mse += (qp -  qo)*(qp -  qo);
+    } 
+
+    report.push_back(PerfReportItem("Normal", algorythm, cells, mse/quantiles.size(), per_ns.count()));
+}
+
+// many series updated in lockstep each tick, P^2 per series vs P2Batch of W series
+template <size_t W> void run_batch_test(std::vector<PerfReportItem>& report, std::vector<double> set, size_t series, std::vector<double> quantiles) 
+{
+    size_t ticks = set.size()/series;
+    std::vector<rtstat::P2> p2(series, rtstat::P2(quantiles));
+    std::vector<rtstat::P2Batch<W> > batch(series/W, rtstat::P2Batch<W>(quantiles));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t t=0; t<ticks; ++t) {
+        const double* values = &set[t*series];
+        for (size_t i=0; i<series; ++i) {
+            p2[i].add(values[i]);
+        }
+    } 
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = (end - start)/(ticks*series);
+    report.push_back(PerfReportItem("Normal", "P^2", series, 0, per_ns.count()));
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t t=0; t<ticks; ++t) {
+        const double* values = &set[t*series];
+        for (size_t i=0; i<series/W; ++i) {
+            batch[i].add(values + i*W);
+        }
+    } 
+    end = std::chrono::high_resolution_clock::now();
+    // W may not divide series, the rest of series is not batched
+    size_t batched = (series/W)*W;
+    per_ns = (end - start)/(ticks*batched);
+
+    double mse = 0;
+    for (size_t i=0; i<batched; ++i) {
+        for (size_t q=0; q<quantiles.size(); ++q) {
+            double d = batch[i/W].quantile(i % W, q) - p2[i].quantile(q);
+            mse += d*d;
+        }
+    }
+    char algorythm[32];
+    snprintf(algorythm, sizeof(algorythm), "P^2(B%zu)", W);
+    report.push_back(PerfReportItem("Normal", algorythm, batched, mse/(batched*quantiles.size()), per_ns.count()));
+}
+
+// quantiles across many T-digests, merge into one T-digest vs virtual merge of views
+void run_query_test(std::vector<PerfReportItem>& report, std::vector<double> set, size_t digests, std::vector<double> quantiles) 
+{
+    std::vector<rtstat::TDigest> td(digests, rtstat::TDigest(100, 100));
+    size_t batch_size = set.size()/digests;
+    for (size_t i=0; i<digests; ++i) {
+        std::sort(set.begin() + i*batch_size, set.begin() + (i + 1)*batch_size);
+        td[i].merge(set.begin() + i*batch_size, set.begin() + (i + 1)*batch_size);
+    }
+    std::vector<double> merged(quantiles.size());
+    std::vector<double> virtual_merged(quantiles.size());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    rtstat::TDigest all(100, 100);
+    for (auto it=td.begin(); it!=td.end(); ++it) {
+        all.merge(*it);
+    }
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        merged[i] = all.quantile(quantiles[i]);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+    report.push_back(PerfReportItem("Normal", "merge", digests, 0, per_ns.count()));
+
+    std::vector<rtstat::TDigest::View> views(digests);
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i=0; i<digests; ++i) {
+        views[i] = td[i].view();
+    }
+    rtstat::TDigest::quantiles(&views[0], views.size(), &quantiles[0], &virtual_merged[0], quantiles.size());
+    end = std::chrono::high_resolution_clock::now();
+    per_ns = end - start;
+
+    double mse = 0;
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        mse += (merged[i] - virtual_merged[i])*(merged[i] - virtual_merged[i]);
+    }
+    report.push_back(PerfReportItem("Normal", "virtual", digests, mse/quantiles.size(), per_ns.count()));
+}
+
+// extreme quantiles error of estimator, optionally merged from shards
+template <class Estimator> void run_tail_test(std::vector<PerfReportItem>& report, const char* algorythm, std::vector<double> set, 
+    std::vector<double> quantiles, Estimator proto, size_t shards, size_t memory)
+{
+    std::vector<double> exact = exact_quantiles(set, quantiles);
+
+    Estimator estimator(proto);
+    std::vector<Estimator> parts(shards, proto);
+    auto start = std::chrono::high_resolution_clock::now();
+    if (shards > 1) {
+        size_t shard_size = set.size()/shards;
+        for (size_t i=0; i<set.size(); ++i) {
+            parts[std::min(i/shard_size, shards - 1)].add(set[i]);
+        }
+        for (auto it=parts.begin(); it!=parts.end(); ++it) {
+            estimator.merge(*it);
+        }
+    }
+    else {
+        for (auto it=set.begin(); it!=set.end(); ++it) {
+            estimator.add(*it);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+
+    double mse = 0;
+    for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
+        double qp = estimator.quantile(*it);
+        double qo = exact[it - quantiles.begin()];
+        mse += (qp - qo)*(qp - qo);
+    }
+    // extremes stay exact when shards are smaller than tails
+    if ((estimator.min() != *std::min_element(set.begin(), set.end())) || (estimator.max() != *std::max_element(set.begin(), set.end()))) {
+        printf("%s: min/max mismatch after merge of %zu shards\n", algorythm, shards);
+    }
+    report.push_back(PerfReportItem("Normal", algorythm, memory, mse/quantiles.size(), per_ns.count()/set.size()));
+}
+
+// worker processes publish T-digests of their shards into shared memory while aggregator merges them
+void run_shm_test(std::vector<PerfReportItem>& report, std::vector<double> set, size_t workers, std::vector<double> quantiles) 
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/rtstat_test_%d", (int) getpid());
+    rtstat::SharedDigests shared;
+    if (!shared.create(name, workers + 1, 100 + 100 + 2)) {
+        printf("shared memory segment is not available\n");
+        return;
+    }
+
+    // publish cost of a single T-digest
+    rtstat::TDigest td(100, 100);
+    td.add(&set[0], set.size()/workers);
+    int slot = shared.acquire();
+    size_t publish_count = 10000;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i=0; i<publish_count; ++i) {
+        shared.publish(slot, td);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+    report.push_back(PerfReportItem("Normal", "publish", 1, 0, per_ns.count()/publish_count));
+    shared.release(slot);
+
+    size_t shard_size = set.size()/workers;
+    std::vector<pid_t> pids;
+    for (size_t w=0; w<workers; ++w) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            rtstat::SharedDigests worker;
+            int worker_slot = worker.open(name) ? worker.acquire() : -1;
+            if (worker_slot < 0) {
+                _exit(1);
+            }
+            rtstat::TDigest worker_td(100, 100);
+            for (size_t i=w*shard_size; i<(w + 1)*shard_size; ++i) {
+                worker_td.add(set[i]);
+                if ((i + 1) % 1000 == 0) {
+                    worker.publish(worker_slot, worker_td);
+                }
+            }
+            worker_td.flush();
+            worker.publish(worker_slot, worker_td);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    // aggregate while workers are running
+    size_t merges = 0;
+    double merge_ns = 0;
+    bool running = true;
+    while (running) {
+        running = false;
+        for (auto it=pids.begin(); it!=pids.end(); ++it) {
+            running = running || (waitpid(*it, NULL, WNOHANG) == 0);
+        }
+        rtstat::TDigest all(100, 100);
+        start = std::chrono::high_resolution_clock::now();
+        shared.merge(all);
+        end = std::chrono::high_resolution_clock::now();
+        per_ns = end - start;
+        merge_ns += per_ns.count();
+        ++merges;
+    }
+    for (auto it=pids.begin(); it!=pids.end(); ++it) {
+        waitpid(*it, NULL, 0);
+    }
+
+    rtstat::TDigest all(100, 100);
+    size_t merged = shared.merge(all);
+    std::vector<double> sset(set.begin(), set.begin() + workers*shard_size);
+    std::sort(sset.begin(), sset.end());
+    double mse = 0;
+    for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
+        double qp = all.quantile(*it);
+        double qo = sset[(size_t) (sset.size()**it)];
+        mse += (qp - qo)*(qp - qo);
+    }
+    if (merged != workers) {
+        printf("merged %zu of %zu workers\n", merged, workers);
+    }
+    report.push_back(PerfReportItem("Normal", "aggregate", workers, mse/quantiles.size(), merge_ns/merges));
+
+    // workers exited without release(), their slots are reclaimed when free slots are exhausted
+    int free_slot = shared.acquire();
+    int reclaimed = shared.acquire();
+    rtstat::SharedDigests::Copy copy;
+    if ((free_slot < 0) || (reclaimed < 0) || !shared.read(reclaimed, copy) || (copy.totalWeight != 0)) {
+        printf("slot of exited worker is not reclaimed\n");
+    }
+
+    // slot published by a broken writer is skipped by aggregator
+    rtstat::TDigest::WeightedPoint broken[] = {rtstat::TDigest::WeightedPoint(2.0, 1.0), rtstat::TDigest::WeightedPoint(1.0, 1.0)};
+    rtstat::TDigest broken_td(100, 100);
+    broken_td.restore(rtstat::TDigest::View(broken, 2, 1.0, 2.0, 2.0));
+    shared.publish(free_slot, broken_td);
+    rtstat::TDigest checked(100, 100);
+    if ((shared.merge(checked) != workers - 1) || (shared.invalidCount() != 1)) {
+        printf("invalid slot is not skipped\n");
+    }
+
+    shared.close();
+    rtstat::SharedDigests::remove(name);
+}
+
+// events of metric_count values (every metric once per event in shuffled order): estimator per metric updated
+//    directly vs MetricSet staging, time is per event
+template <class Estimator> void run_metric_set_test(std::vector<PerfReportItem>& report, const char* algorythm, std::vector<double> set, 
+    size_t metric_count, size_t events, Estimator prototype, size_t batch_size)
+{
+    std::default_random_engine generator(1);
+    std::vector<typename rtstat::MetricSet<Estimator>::Sample> event(metric_count);
+    for (size_t m=0; m<metric_count; ++m) {
+        event[m].metric = m;
+    }
+    std::shuffle(event.begin(), event.end(), generator);
+
+    std::vector<Estimator> estimators(metric_count, prototype);
+    rtstat::MetricSet<Estimator> metrics(metric_count, prototype, batch_size);
+    size_t offset = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t e=0; e<events; ++e) {
+        // metric m values are set values scaled by metric
+        for (size_t m=0; m<metric_count; ++m) {
+            event[m].value = set[offset]*(1 + event[m].metric);
+            offset = (offset + 1 < set.size()) ? offset + 1 : 0;
+        }
+        if (batch_size) {
+            metrics.record(&event[0], event.size());
+        }
+        else {
+            for (auto it=event.begin(); it!=event.end(); ++it) {
+                estimators[it->metric].add(it->value);
+            }
+        }
+    }
+    metrics.flush();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+    report.push_back(PerfReportItem("Normal", algorythm, batch_size, 0, per_ns.count()/events));
+}
+
+// quantiles over [from, to) of 10 s digests from rollup against virtual merge of all 10 s digests of range,
+//    rmse against exact quantiles of range values, combined buckets must be the minimal cover of the range
+void run_rollup_range_test(std::vector<PerfReportItem>& report, const char* range_name, const rtstat::Rollup& rollup, 
+    const std::vector<rtstat::TDigest>& digests, const std::vector<std::vector<double> >& values, 
+    int64_t from, int64_t to, std::vector<double> quantiles, size_t repeats, size_t expected_buckets)
+{
+    std::vector<double> exact;
+    std::vector<rtstat::TDigest::View> views;
+    for (int64_t b=from/10; b<(to + 9)/10; ++b) {
+        exact.insert(exact.end(), values[b].begin(), values[b].end());
+        views.push_back(digests[b].view());
+    }
+    std::sort(exact.begin(), exact.end());
+
+    std::vector<double> result(quantiles.size());
+    size_t used = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    double weight = 0;
+    for (size_t r=0; r<repeats; ++r) {
+        used = rollup.quantiles("latency", from, to, &quantiles[0], &result[0], quantiles.size(), &weight);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::micro> rollup_us = end - start;
+    double rollup_mse = 0;
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        double qo = exact[(size_t) (exact.size()*quantiles[i])];
+        rollup_mse += (result[i] - qo)*(result[i] - qo);
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t r=0; r<repeats; ++r) {
+        rtstat::TDigest::quantiles(&views[0], views.size(), &quantiles[0], &result[0], quantiles.size());
+    }
+    end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::micro> all_us = end - start;
+    double all_mse = 0;
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        double qo = exact[(size_t) (exact.size()*quantiles[i])];
+        all_mse += (result[i] - qo)*(result[i] - qo);
+    }
+
+    if ((used != expected_buckets) || (weight != exact.size())) {
+        printf("%s: rollup combined %zu buckets of weight %.0f, expected %zu buckets of weight %zu\n", 
+            range_name, used, weight, expected_buckets, exact.size());
+    }
+    report.push_back(PerfReportItem(range_name, "10s", views.size(), all_mse/quantiles.size(), all_us.count()/repeats));
+    report.push_back(PerfReportItem(range_name, "Rollup", used, rollup_mse/quantiles.size(), rollup_us.count()/repeats));
+}
+
+// rollup of about 1.8 days of 10 s digests: range queries, save/load round trip and rejection of broken files
+void run_rollup_test(std::vector<PerfReportItem>& report, RollupFileReportItem& file, std::default_random_engine& generator, 
+    std::vector<double> quantiles)
+{
+    // about 1.8 days of 10 s digests of 100 latencies (ms) with daily cycle, compacted every 10 min and at the end,
+    //    the end is inside of partially rolled up minute, hour and day
+    const int64_t DAY = 86400;
+    const int64_t NOW = 2*DAY - 5*3600 - 1770;
+    std::vector<rtstat::TDigest> digests;
+    std::vector<std::vector<double> > values(NOW/10);
+    std::vector<double> sorted;
+    std::lognormal_distribution<double> latency(13.8, 0.5); // median is about 1ms
+    rtstat::Rollup rollup(rtstat::Rollup::defaultTiers(), 100, 150);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int64_t b=0; b<NOW/10; ++b) {
+        double scale = 1.0 + 0.5*sin(2*M_PI*b*10/DAY);
+        for (size_t i=0; i<100; ++i) {
+            values[b].push_back(scale*latency(generator)/1e6);
+        }
+        sorted = values[b];
+        std::sort(sorted.begin(), sorted.end());
+        digests.push_back(rtstat::TDigest(100, 150));
+        digests.back().merge(sorted.begin(), sorted.end());
+        rollup.add("latency", b*10, digests.back().view());
+        if ((b + 1) % 60 == 0) {
+            rollup.compact((b + 1)*10);
+        }
+    }
+    rollup.compact(NOW);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> ingest_ms = end - start;
+
+    // minimal covers: 10 s buckets after the last complete minute (3), minutes after the last complete hour (30),
+    //    hours after the last complete day (18), days, finer buckets on the range start edge,
+    //    10 s buckets are kept for 1 h only, so older ranges start at minute
+    run_rollup_range_test(report, "last 30 s", rollup, digests, values, NOW - 30, NOW, quantiles, 100, 3);
+    run_rollup_range_test(report, "last 10 min", rollup, digests, values, NOW - 600, NOW, quantiles, 100, 3 + 9 + 3);
+    run_rollup_range_test(report, "last 30 min", rollup, digests, values, NOW - 1800, NOW, quantiles, 100, 3 + 29 + 3);
+    run_rollup_range_test(report, "last 1 h", rollup, digests, values, NOW - 3600, NOW, quantiles, 100, 3 + 29 + 30 + 3);
+    run_rollup_range_test(report, "last 6 h", rollup, digests, values, NOW - 6*3600 - 30, NOW, quantiles, 20, 30 + 5 + 30 + 3);
+    run_rollup_range_test(report, "last day", rollup, digests, values, NOW - DAY - 30, NOW, quantiles, 10, 30 + 5 + 18 + 30 + 3);
+    run_rollup_range_test(report, "all", rollup, digests, values, 0, NOW, quantiles, 10, 1 + 18 + 30 + 3);
+
+    // file of this process in TMPDIR, removed after save/load and after broken copies
+    char path[256];
+    snprintf(path, sizeof(path), "%s/rtstat_rollup_%d.bin", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int) getpid());
+    start = std::chrono::high_resolution_clock::now();
+    bool saved = rollup.save(path);
+    rtstat::Rollup loaded(rtstat::Rollup::defaultTiers(), 100, 150);
+    bool restored = saved && loaded.load(path);
+    end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> file_ms = end - start;
+    FILE* f = fopen(path, "rb");
+    long file_size = 0;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        file_size = ftell(f);
+        fclose(f);
+    }
+    remove(path);
+
+    // loaded tiers give the same quantiles, truncated and corrupted files are rejected
+    int64_t ranges[][2] = {{NOW - 600, NOW}, {NOW - 6*3600 - 30, NOW}, {0, NOW}};
+    std::vector<double> original(quantiles.size());
+    std::vector<double> reloaded(quantiles.size());
+    for (size_t i=0; restored && (i<sizeof(ranges)/sizeof(ranges[0])); ++i) {
+        size_t used = rollup.quantiles("latency", ranges[i][0], ranges[i][1], &quantiles[0], &original[0], quantiles.size());
+        size_t reused = loaded.quantiles("latency", ranges[i][0], ranges[i][1], &quantiles[0], &reloaded[0], quantiles.size());
+        restored = (used == reused) && (original == reloaded);
+    }
+    std::string image(file_size > 0 ? file_size : 0, '\0');
+    rollup.save(path);
+    f = fopen(path, "rb");
+    if (f) {
+        image.resize(fread(&image[0], 1, image.size(), f));
+        fclose(f);
+    }
+    size_t rejected = 0;
+    for (size_t i=0; i<3; ++i) {
+        std::string broken(image);
+        if (i == 0) {
+            broken.resize(broken.size()/2); // truncated
+        }
+        else if (i == 1) {
+            std::fill(broken.end() - 4096, broken.end(), '\xff'); // NaN centroids
+        }
+        else {
+            std::fill(broken.begin() + broken.size()/2, broken.begin() + broken.size()/2 + 4096, '\x7f'); // garbage in the middle
+        }
+        f = fopen(path, "wb");
+        if (f) {
+            fwrite(broken.data(), 1, broken.size(), f);
+            fclose(f);
+        }
+        rtstat::Rollup corrupted(rtstat::Rollup::defaultTiers(), 100, 150);
+        rejected += !corrupted.load(path);
+    }
+    remove(path);
+
+    file.digests_ = digests.size();
+    file.ingest_ms_ = ingest_ms.count();
+    file.file_size_ = file_size;
+    file.file_ms_ = file_ms.count();
+    file.restored_ = restored;
+    file.rejected_ = rejected;
+}
+
+// merge() and quantile() sweep over fleet of T-digests, every worker sweeps its shard in shuffled order.
+//    arena: shards are allocated from per-node huge page arenas by workers pinned to the node,
+//    otherwise from heap by the main thread with unpinned workers
+void run_arena_test(std::vector<PerfReportItem>& report, const std::vector<double>& set, size_t digest_count, bool arena, size_t passes)
+{
+    rtstat::NumaTopology topology;
+    size_t workers = topology.nodes();
+    size_t shard_size = digest_count/workers;
+    std::vector<std::vector<double> > batches(set.size()/100);
+    for (size_t b=0; b<batches.size(); ++b) {
+        batches[b].assign(set.begin() + b*100, set.begin() + (b + 1)*100);
+        std::sort(batches[b].begin(), batches[b].end());
+    }
+
+    std::vector<std::unique_ptr<rtstat::Arena> > arenas(workers);
+    std::vector<std::vector<rtstat::TDigest> > shards(workers);
+    auto build = [&](size_t w) {
+        if (arena) {
+            topology.pin(w);
+            arenas[w].reset(new rtstat::Arena(w));
+        }
+        shards[w].reserve(shard_size);
+        for (size_t i=0; i<shard_size; ++i) {
+            shards[w].push_back(rtstat::TDigest(100, 150, 0, arenas[w].get()));
+            const std::vector<double>& batch = batches[(w*shard_size + i) % batches.size()];
+            shards[w].back().merge(batch.begin(), batch.end());
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t w=0; w<workers; ++w) {
+        if (arena) {
+            threads.push_back(std::thread(build, w));
+        }
+        else {
+            build(w);
+        }
+    }
+    for (auto it=threads.begin(); it!=threads.end(); ++it) {
+        it->join();
+    }
+    threads.clear();
+
+    std::vector<double> sink(workers);
+    auto sweep = [&](size_t w) {
+        if (arena) {
+            topology.pin(w);
+        }
+        std::vector<size_t> order(shards[w].size());
+        for (size_t i=0; i<order.size(); ++i) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin(), order.end(), std::default_random_engine(w + 1));
+        rtstat::TDigest total(100, 150);
+        for (size_t p=0; p<passes; ++p) {
+            for (auto it=order.begin(); it!=order.end(); ++it) {
+                total.merge(shards[w][*it].view());
+                sink[w] += shards[w][*it].quantile(0.99);
+            }
+        }
+        sink[w] += total.quantile(0.5);
+    };
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t w=0; w<workers; ++w) {
+        threads.push_back(std::thread(sweep, w));
+    }
+    for (auto it=threads.begin(); it!=threads.end(); ++it) {
+        it->join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+
+    size_t huge = 0;
+    size_t bound = 0;
+    for (auto it=arenas.begin(); it!=arenas.end(); ++it) {
+        huge += *it ? (*it)->hugeRegions() : 0;
+        bound += *it ? (*it)->bound() : 0;
+    }
+    char algorythm[64];
+    snprintf(algorythm, sizeof(algorythm), arena ? "Arena(%d/%d/%d)" : "Heap(%d)", (int) workers, (int) huge, (int) bound);
+    report.push_back(PerfReportItem("Normal", algorythm, workers*shard_size, 0, per_ns.count()/(workers*shard_size*passes)));
+}
+
+// ground truth of stream from verifier fed by batches against sorted copy, samples are spilled runs or reservoir size
+void run_verify_mode_test(std::vector<PerfReportItem>& report, const char* algorythm, const std::vector<double>& set, 
+    std::vector<double> quantiles, size_t chunk_size, size_t reservoir_size, size_t fan_in)
+{
+    std::vector<double> result(quantiles.size());
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t samples = 0;
+    if (chunk_size) {
+        rtstat::ExactQuantiles verifier(chunk_size, reservoir_size, NULL, fan_in);
+        for (size_t i=0; i<set.size(); i+=1000) {
+            verifier.add(&set[i], std::min((size_t) 1000, set.size() - i));
+        }
+        if (!verifier.quantiles(&quantiles[0], &result[0], quantiles.size())) {
+            printf("verifier failed: %s\n", algorythm);
+        }
+        samples = reservoir_size ? reservoir_size : verifier.runs();
+    }
+    else {
+        std::vector<double> sorted(set);
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t i=0; i<quantiles.size(); ++i) {
+            result[i] = sorted[(size_t) (sorted.size()*quantiles[i])];
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+
+    std::vector<double> sorted(set);
+    std::sort(sorted.begin(), sorted.end());
+    double mse = 0;
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        double qo = sorted[(size_t) (sorted.size()*quantiles[i])];
+        mse += (result[i] - qo)*(result[i] - qo);
+    }
+    report.push_back(PerfReportItem("Lognormal", algorythm, samples, mse/quantiles.size(), per_ns.count()/set.size()));
+}
+
+// 4M latencies (ms), verifier modes: exact with spilled runs (cascade above fan-in) and reservoir
+void run_verify_test(std::vector<PerfReportItem>& report, std::default_random_engine& generator, std::vector<double> quantiles)
+{
+    std::lognormal_distribution<double> latency(13.8, 0.5); // median is about 1ms
+    std::vector<double> sample_ms(4000000);
+    std::generate(sample_ms.begin(), sample_ms.end(), [&latency, &generator]() { return latency(generator)/1e6; } );
+    run_verify_mode_test(report, "Sort", sample_ms, quantiles, 0, 0, 0);
+    run_verify_mode_test(report, "Exact(4M)", sample_ms, quantiles, 4000000, 0, 64);
+    run_verify_mode_test(report, "Exact(256k)", sample_ms, quantiles, 1 << 18, 0, 64);
+    run_verify_mode_test(report, "Exact(32k)", sample_ms, quantiles, 1 << 15, 0, 64);
+    run_verify_mode_test(report, "Exact(32k,4)", sample_ms, quantiles, 1 << 15, 0, 4);
+    run_verify_mode_test(report, "Reservoir", sample_ms, quantiles, 1, 10000, 0);
+    run_verify_mode_test(report, "Reservoir", sample_ms, quantiles, 1, 100000, 0);
+}
+
+// small sorted batches merged into T-digest of large delta, rmse of quantiles
+void run_merge_test(std::vector<PerfReportItem>& report, const char* distribution, std::vector<double> set, std::vector<double> quantiles, size_t delta, size_t batch_size) 
+{
+    rtstat::TDigest td(delta, 100);
+    std::vector<double> batch;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i=0; i + batch_size<=set.size(); i+=batch_size) {
+        batch.assign(set.begin() + i, set.begin() + i + batch_size);
+        std::sort(batch.begin(), batch.end());
+        td.merge(batch.begin(), batch.end());
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+
+    std::sort(set.begin(), set.end());
+    double mse = 0;
+    for (auto it=quantiles.begin(); it!=quantiles.end(); ++it) {
+        double qp = td.quantile(*it);
+        double qo = set[(size_t) (set.size()**it)];
+        mse += (qp - qo)*(qp - qo);
+    }
+    report.push_back(PerfReportItem(distribution, "T-digest(M)", delta, mse/quantiles.size(), per_ns.count()/set.size()));
+}
+
+template <typename T> double quantile(const rtstat::BasicP2<T>& estimator, double /* q */, size_t qindex) { return estimator.quantile(qindex); }
+template <typename T> double quantile(const rtstat::BasicTDigest<T>& estimator, double q, size_t /* qindex */) { return estimator.quantile(q); }
+template <typename T> void add_sorted(rtstat::BasicP2<T>& estimator, const std::vector<T>& batch) { estimator.add(batch.begin(), batch.end()); }
+template <typename T> void add_sorted(rtstat::BasicTDigest<T>& estimator, const std::vector<T>& batch) { estimator.merge(batch.begin(), batch.end()); }
+
+// integer stream of latencies (ns) into estimator of value type T, values are converted at call site for double
+template <class Estimator, typename T> void run_integer_test(std::vector<PerfReportItem>& report, const char* algorythm, 
+    std::vector<uint64_t> set, std::vector<double> quantiles, Estimator estimator, size_t batch_size)
+{
+    std::vector<uint64_t> sset(set);
+    std::sort(sset.begin(), sset.end());
+
+    std::vector<T> batch(batch_size);
+    auto start = std::chrono::high_resolution_clock::now();
+    if (batch_size > 1) {
+        for (size_t i=0; i + batch_size<=set.size(); i+=batch_size) {
+            for (size_t j=0; j<batch_size; ++j) {
+                batch[j] = static_cast<T>(set[i + j]);
+            }
+            std::sort(batch.begin(), batch.end());
+            add_sorted(estimator, batch);
+        }
+    }
+    else {
+        for (auto it=set.begin(); it!=set.end(); ++it) {
+            estimator.add(static_cast<T>(*it));
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> per_ns = end - start;
+
+    double mse = 0;
+    for (size_t i=0; i<quantiles.size(); ++i) {
+        double qp = quantile(estimator, quantiles[i], i)/1000;
+        double qo = (double) sset[(size_t) (sset.size()*quantiles[i])]/1000;
+        mse += (qp - qo)*(qp - qo);
+    }
+    if ((estimator.min() != sset.front()) || (estimator.max() != sset.back())) {
+        printf("%s: min/max are not exact: %f/%f\n", algorythm, (double) estimator.min(), (double) estimator.max());
+    }
+    report.push_back(PerfReportItem("LogNormal", algorythm, set.size(), mse/quantiles.size(), per_ns.count()/set.size()));
+}
+
+// single writer adds values while readers query p99: readers lock the T-digest vs read published snapshots
+void run_concurrency_test(std::vector<ConcurrencyReportItem>& report, std::vector<double> set, size_t readers, bool publisher, size_t publish_every) 
+{
+    rtstat::TDigest td(100, 100);
+    std::mutex lock;
+    rtstat::Publisher<rtstat::TDigest::Snapshot> snapshots;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> reads(0);
+    std::atomic<double> read_ns(0);
+    double write_ns = 0;
+
+    auto writer = [&]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i=0; i<set.size(); ++i) {
+            if (publisher) {
+                td.add(set[i]);
+                if ((i + 1) % publish_every == 0) {
+                    snapshots.publish([&td](rtstat::TDigest::Snapshot& snapshot) { td.snapshot(snapshot); });
+                }
+            }
+            else {
+                std::lock_guard<std::mutex> guard(lock);
+                td.add(set[i]);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::nano> per_ns = end - start;
+        write_ns = per_ns.count()/set.size();
+        done.store(true);
+    };
+    auto reader = [&]() {
+        size_t count = 0;
+        double sum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (!done.load()) {
+            if (publisher) {
+                rtstat::Publisher<rtstat::TDigest::Snapshot>::Reader snapshot(snapshots);
+                sum += snapshot->quantile(0.99);
+            }
+            else {
+                std::lock_guard<std::mutex> guard(lock);
+                sum += td.quantile(0.99);
+            }
+            ++count;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::nano> per_ns = end - start;
+        reads.fetch_add(count);
+        double ns = read_ns.load();
+        while (count && !read_ns.compare_exchange_weak(ns, ns + per_ns.count()/count/readers)) {}
+        if (sum < 0) { printf("unexpected sum %f\n", sum); }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<readers; ++i) {
+        threads.push_back(std::thread(reader));
+    }
+    writer();
+    for (auto it=threads.begin(); it!=threads.end(); ++it) {
+        it->join();
+    }
+    report.push_back(ConcurrencyReportItem(publisher ? "snapshot" : "mutex", readers, write_ns, read_ns.load(), reads.load()));
+}
+
 void run_perf_test(std::vector<PerfReportItem>& report, size_t samples, std::vector<double> quantiles) 
 {
     std::default_random_engine generator(1);
@@ -185,6 +1016,13 @@ void run_perf_test(std::vector<PerfReportItem>& report, size_t samples, std::vec
     }
     report.push_back(PerfReportItem("Normal", "P^2", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
 
+    rmse = 0;
+    time_stat = 0;
+    for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
+        run_perf_test_p2_merge(sample_n, quantiles, &rmse, &time_stat);
+    }
+    report.push_back(PerfReportItem("Normal", "P^2(M)", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
+
     rmse = 0;
     time_stat = 0;
     for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
@@ -208,6 +1046,13 @@ void run_perf_test(std::vector<PerfReportItem>& report, size_t samples, std::vec
     }
     report.push_back(PerfReportItem("Log-normal", "P^2", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
 
+    rmse = 0;
+    time_stat = 0;
+    for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
+        run_perf_test_p2_merge(sample_ln, quantiles, &rmse, &time_stat);
+    }
+    report.push_back(PerfReportItem("Log-normal", "P^2(M)", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
+
     rmse = 0;
     time_stat = 0;
     for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
@@ -231,6 +1076,13 @@ void run_perf_test(std::vector<PerfReportItem>& report, size_t samples, std::vec
     }
     report.push_back(PerfReportItem("Normal-2", "P^2", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
 
+    rmse = 0;
+    time_stat = 0;
+    for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
+        run_perf_test_p2_merge(sample_n2, quantiles, &rmse, &time_stat);
+    }
+    report.push_back(PerfReportItem("Normal-2", "P^2(M)", samples, rmse, time_stat/SAMLPE_PASS_COUNT));
+
     rmse = 0;
     time_stat = 0;
     for (size_t i=0; i<SAMLPE_PASS_COUNT; ++i) {
@@ -272,6 +1124,186 @@ int main (int argc, char *argv[])
         printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
     }
 
+    std::vector<LatencyReportItem> latency_report;
+    std::default_random_engine generator(1);
+    std::normal_distribution<double> norm(60.0, 10.0);
+    std::vector<double> sample_n(200000);
+    std::generate(sample_n.begin(), sample_n.end(), [&norm, &generator]() { return norm(generator); } );
+
+    std::vector<PerfReportItem> histogram_report;
+    size_t C[] = {10, 100, 200, 500};
+    for (size_t i=0; i<sizeof(C)/sizeof(size_t); ++i) {
+        run_histogram_test<rtstat::P2>(histogram_report, "P^2", sample_n, C[i]);
+        run_histogram_test<rtstat::LazyP2>(histogram_report, "P^2(L)", sample_n, C[i]);
+    }
+
+    printf("Histogram report: %d\n", histogram_report.size());
+    printf(" distribution         algo      cells       rmse   item(ns)\n");
+    for (auto it=histogram_report.begin(); it!=histogram_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+    size_t D[] = {30, 300, 1000};
+    for (size_t i=0; i<sizeof(D)/sizeof(size_t); ++i) {
+        run_latency_test_tdigest(latency_report, sample_n, D[i], 50, 0);
+        run_latency_test_tdigest(latency_report, sample_n, D[i], 50, 8);
+        run_latency_test_tdigest(latency_report, sample_n, D[i], 50, 32);
+    }
+
+    std::vector<PerfReportItem> batch_report;
+    run_batch_test<4>(batch_report, sample_n, 256, quantiles3);
+    run_batch_test<8>(batch_report, sample_n, 256, quantiles3);
+    run_batch_test<6>(batch_report, sample_n, 256, quantiles3); // scalar lanes for W % SIMD width
+
+    printf("Batch report (rmse to P^2): %d\n", batch_report.size());
+    printf(" distribution         algo     series       rmse   item(ns)\n");
+    for (auto it=batch_report.begin(); it!=batch_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> query_report;
+    run_query_test(query_report, sample_n, 10, quantiles3);
+    run_query_test(query_report, sample_n, 100, quantiles3);
+    run_query_test(query_report, sample_n, 500, quantiles3);
+    run_query_test(query_report, sample_n, 500, std::vector<double>(1, 0.99));
+
+    printf("Query report (rmse to merge): %d\n", query_report.size());
+    printf(" distribution         algo    digests       rmse  query(ns)\n");
+    for (auto it=query_report.begin(); it!=query_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.0f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> tail_report;
+    double QT[] = {0.0001, 0.001, 0.999, 0.9999};
+    std::vector<double> tail_quantiles(QT, QT + sizeof(QT) / sizeof(double));
+    // memory of centroids buffer (16 bytes per centroid) and of tails (8 bytes per value)
+    run_tail_test(tail_report, "T-digest", sample_n, tail_quantiles, rtstat::TDigest(100, 150), 1, 252*16);
+    run_tail_test(tail_report, "T-digest", sample_n, tail_quantiles, rtstat::TDigest(1000, 150), 1, 2502*16);
+    run_tail_test(tail_report, "T-digest(T)", sample_n, tail_quantiles, rtstat::TailDigest(256, 256, 100, 150), 1, 252*16 + 512*8);
+    run_tail_test(tail_report, "T-digest(M)", sample_n, tail_quantiles, rtstat::TDigest(100, 150), 4, 252*16);
+    run_tail_test(tail_report, "T-digest(TM)", sample_n, tail_quantiles, rtstat::TailDigest(256, 256, 100, 150), 4, 252*16 + 512*8);
+    // shards of 200 values are smaller than tails
+    run_tail_test(tail_report, "T-digest(M)", sample_n, tail_quantiles, rtstat::TDigest(100, 150), 1000, 252*16);
+    run_tail_test(tail_report, "T-digest(TM)", sample_n, tail_quantiles, rtstat::TailDigest(256, 256, 100, 150), 1000, 252*16 + 512*8);
+
+    printf("Tail report (q=0.0001, 0.001, 0.999, 0.9999): %d\n", tail_report.size());
+    printf(" distribution         algo  memory(B)       rmse   item(ns)\n");
+    for (auto it=tail_report.begin(); it!=tail_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> metric_report;
+    run_metric_set_test(metric_report, "T-digest", sample_n, 40, 50000, rtstat::TDigest(100, 100), 0);
+    run_metric_set_test(metric_report, "T-digest(S)", sample_n, 40, 50000, rtstat::TDigest(100, 100), 32);
+    run_metric_set_test(metric_report, "T-digest(S)", sample_n, 40, 50000, rtstat::TDigest(100, 100), 128);
+    run_metric_set_test(metric_report, "P^2", sample_n, 40, 50000, rtstat::P2(quantiles3), 0);
+    run_metric_set_test(metric_report, "P^2(S)", sample_n, 40, 50000, rtstat::P2(quantiles3), 32);
+    run_metric_set_test(metric_report, "P^2(S)", sample_n, 40, 50000, rtstat::P2(quantiles3), 128);
+
+    printf("Metric set report (40 metrics per event): %d\n", metric_report.size());
+    printf(" distribution         algo      batch  events/s  event(ns)\n");
+    for (auto it=metric_report.begin(); it!=metric_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.0f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, 1e9/it->time_stat_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> merge_report;
+    std::normal_distribution<double> step(0.0, 1.0);
+    std::vector<double> sample_drift(sample_n.size());
+    double level = 60.0;
+    for (auto it=sample_drift.begin(); it!=sample_drift.end(); ++it) {
+        level += 0.05*step(generator);
+        *it = level + 0.1*step(generator);
+    }
+    size_t MD[] = {100, 1000, 5000};
+    for (size_t i=0; i<sizeof(MD)/sizeof(size_t); ++i) {
+        run_merge_test(merge_report, "Normal", sample_n, quantiles3, MD[i], 10);
+        run_merge_test(merge_report, "Drift", sample_drift, quantiles3, MD[i], 10);
+    }
+
+    printf("Merge report (batch 10): %d\n", merge_report.size());
+    printf(" distribution         algo      delta       rmse   item(ns)\n");
+    for (auto it=merge_report.begin(); it!=merge_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> integer_report;
+    std::lognormal_distribution<double> latency(13.8, 0.5); // median is about 1ms
+    std::vector<uint64_t> sample_ns(sample_n.size());
+    std::generate(sample_ns.begin(), sample_ns.end(), [&latency, &generator]() { return (uint64_t) latency(generator); } );
+    run_integer_test<rtstat::BasicP2<double>, double>(integer_report, "P^2<d>", sample_ns, quantiles3, rtstat::BasicP2<double>(quantiles3), 1);
+    run_integer_test<rtstat::BasicP2<uint64_t>, uint64_t>(integer_report, "P^2<u64>", sample_ns, quantiles3, rtstat::BasicP2<uint64_t>(quantiles3), 1);
+    run_integer_test<rtstat::BasicTDigest<double>, double>(integer_report, "T-digest<d>", sample_ns, quantiles3, rtstat::BasicTDigest<double>(100, 100), 1);
+    run_integer_test<rtstat::BasicTDigest<uint64_t>, uint64_t>(integer_report, "T-digest<u64>", sample_ns, quantiles3, rtstat::BasicTDigest<uint64_t>(100, 100), 1);
+    run_integer_test<rtstat::BasicTDigest<double>, double>(integer_report, "T-d(M)<d>", sample_ns, quantiles3, rtstat::BasicTDigest<double>(100, 100), 200);
+    run_integer_test<rtstat::BasicTDigest<uint64_t>, uint64_t>(integer_report, "T-d(M)<u64>", sample_ns, quantiles3, rtstat::BasicTDigest<uint64_t>(100, 100), 200);
+
+    printf("Integer report (rmse in us): %d\n", integer_report.size());
+    printf(" distribution         algo    samples       rmse   item(ns)\n");
+    for (auto it=integer_report.begin(); it!=integer_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> rollup_report;
+    RollupFileReportItem rollup_file;
+    run_rollup_test(rollup_report, rollup_file, generator, quantiles3);
+
+    printf("Rollup report (tiers 10s/1m/1h/1d, %d digests, ingest %.1f ms, file %ld B, save+load %.1f ms%s, rejected %zu of 3 broken files): %d\n", 
+        rollup_file.digests_, rollup_file.ingest_ms_, rollup_file.file_size_, rollup_file.file_ms_, rollup_file.restored_ ? "" : " FAILED", rollup_file.rejected_, rollup_report.size());
+    printf("        range         algo    buckets       rmse  query(us)\n");
+    for (auto it=rollup_report.begin(); it!=rollup_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> verify_report;
+    run_verify_test(verify_report, generator, quantiles3);
+
+    printf("Verification report (4M values, rmse to sorted copy): %d\n", verify_report.size());
+    printf(" distribution         algo runs/size       rmse   item(ns)\n");
+    for (auto it=verify_report.begin(); it!=verify_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> shm_report;
+    run_shm_test(shm_report, sample_n, 4, quantiles3);
+    run_shm_test(shm_report, sample_n, 16, quantiles3);
+
+    printf("Shared memory report (rmse to exact): %d\n", shm_report.size());
+    printf(" distribution         algo    workers       rmse    op(ns)\n");
+    for (auto it=shm_report.begin(); it!=shm_report.end(); ++it) {
+        printf(" %12s %12s %10d %10.4f %10.0f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->RMSE_, it->time_stat_);
+    }
+
+    std::vector<PerfReportItem> arena_report;
+    size_t FLEET[] = {1000, 20000};
+    for (size_t i=0; i<sizeof(FLEET)/sizeof(size_t); ++i) {
+        run_arena_test(arena_report, sample_n, FLEET[i], false, 5);
+        run_arena_test(arena_report, sample_n, FLEET[i], true, 5);
+    }
+
+    printf("Arena report (merge + p99 per digest, delta 100, algo(nodes/huge regions/bound regions)): %d\n", arena_report.size());
+    printf(" distribution             algo    digests   digest(ns)\n");
+    for (auto it=arena_report.begin(); it!=arena_report.end(); ++it) {
+        printf(" %12s %16s %10d %12.2f\n", it->distribution_.c_str(), it->algorythm_.c_str(), it->samples_, it->time_stat_);
+    }
+
+    std::vector<ConcurrencyReportItem> concurrency_report;
+    size_t R[] = {1, 2, 4};
+    for (size_t i=0; i<sizeof(R)/sizeof(size_t); ++i) {
+        run_concurrency_test(concurrency_report, sample_n, R[i], false, 0);
+        run_concurrency_test(concurrency_report, sample_n, R[i], true, 1000);
+    }
+
+    printf("Concurrency report (p99 readers, publish every 1000 adds): %d\n", concurrency_report.size());
+    printf("         algo    readers  write(ns)   read(ns)      reads\n");
+    for (auto it=concurrency_report.begin(); it!=concurrency_report.end(); ++it) {
+        printf(" %12s %10d %10.2f %10.2f %10d\n", it->algorythm_.c_str(), it->readers_, it->write_ns_, it->read_ns_, it->reads_);
+    }
+
+    printf("Latency report (ns): %d\n", latency_report.size());
+    printf("         algo      delta       step       mean    p99.99        max\n");
+    for (auto it=latency_report.begin(); it!=latency_report.end(); ++it) {
+        printf(" %12s %10d %10d %10.2f %10.2f %10.2f\n", it->algorythm_.c_str(), it->delta_, it->step_, it->mean_, it->p9999_, it->max_);
+    }
+
     printf("Done.\n");
 
     return 0;
@@ -0,0 +1,125 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "tuner.hpp"
+
+static std::vector<double> parseList(const char* text)
+{
+    std::vector<double> values;
+    const char* it = text;
+    while (*it) {
+        char* end;
+        values.push_back(strtod(it, &end));
+        if (end == it) {
+            break;
+        }
+        it = (*end == ',') ? end + 1 : end;
+    }
+    return values;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-q quantiles] [-e rank error] [-m memory bytes] [-t threads] [-n normal samples] [trace file | -]\n"
+        "  -q  target quantiles, comma separated (default 0.5,0.9,0.99,0.999)\n"
+        "  -e  rank error budget (default 0.001)\n"
+        "  -m  memory budget in bytes (default 16384)\n"
+        "  -t  sweep threads (default hardware concurrency)\n"
+        "  -n  synthetic trace of normal samples instead of trace file, one value per line\n", name);
+}
+
+// rtstat_tune: recommends T-digest delta, excessive growth and ingestion mode for a trace
+int main(int argc, char *argv[])
+{
+    std::vector<double> quantiles = parseList("0.5,0.9,0.99,0.999");
+    double rankError = 0.001;
+    size_t memory = 16384;
+    size_t threads = 0;
+    size_t normal = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "q:e:m:t:n:h")) != -1) {
+        switch (opt) {
+            case 'q': quantiles = parseList(optarg); break;
+            case 'e': rankError = atof(optarg); break;
+            case 'm': memory = atol(optarg); break;
+            case 't': threads = atol(optarg); break;
+            case 'n': normal = atol(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    std::vector<double> trace;
+    if (normal) {
+        std::default_random_engine generator(1);
+        std::normal_distribution<double> norm(60.0, 10.0);
+        trace.resize(normal);
+        std::generate(trace.begin(), trace.end(), [&norm, &generator]() { return norm(generator); } );
+    }
+    else if (optind < argc) {
+        FILE* f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+        if (!f) {
+            perror(argv[optind]);
+            return 1;
+        }
+        double value;
+        while (fscanf(f, "%lf", &value) == 1) {
+            trace.push_back(value);
+        }
+        if (f != stdin) {
+            fclose(f);
+        }
+    }
+    if (trace.empty() || quantiles.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    rtstat::Tuner tuner(quantiles, rankError, memory);
+    std::vector<rtstat::Tuner::Result> results = tuner.sweep(trace, threads);
+    int best = rtstat::Tuner::recommend(results);
+
+    printf("trace: %zu values, rank error budget: %g, memory budget: %zu bytes\n", trace.size(), rankError, memory);
+    printf("      delta   growth    batch   rank err    bytes   item(ns)\n");
+    for (size_t i=0; i<results.size(); ++i) {
+        const rtstat::Tuner::Result& r = results[i];
+        printf(" %c%c %7zu %8zu %8zu %10.6f %8zu %10.2f\n", (int) i == best ? '>' : ' ', r.pareto ? '*' : ' ', 
+            r.config.delta, r.config.growthPCT, r.config.batchSize, r.rankError, r.bytes, r.nsPerItem);
+    }
+    printf("* - Pareto frontier (rank error, bytes, time), > - recommended\n");
+    if (best >= 0) {
+        const rtstat::Tuner::Result& r = results[best];
+        printf("recommended: TDigest(%zu, %zu) with %s, %s budget\n", r.config.delta, r.config.growthPCT, 
+            r.config.batchSize ? "merge() of sorted batches" : "add()", r.withinBudget ? "within" : "OUT OF");
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <time.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "tdigest.hpp"
+#include "tuner.hpp"
+
+namespace rtstat {
+
+static double threadTime() // CPU time of calling thread (ns), not affected by other sweep threads
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+Tuner::Tuner(std::vector<double> quantiles, double rankErrorBudget, size_t memoryBudget)
+    : quantiles_(quantiles), rankErrorBudget_(rankErrorBudget), memoryBudget_(memoryBudget)
+{
+    size_t deltas[] = {10, 20, 50, 100, 200, 500, 1000};
+    size_t growths[] = {25, 50, 100, 150, 200};
+    size_t batchSizes[] = {0, 200};
+    deltas_.assign(deltas, deltas + sizeof(deltas)/sizeof(size_t));
+    growths_.assign(growths, growths + sizeof(growths)/sizeof(size_t));
+    batchSizes_.assign(batchSizes, batchSizes + sizeof(batchSizes)/sizeof(size_t));
+}
+
+Tuner::Result Tuner::run(const Tuner::Config& config, const std::vector<double>& trace, const std::vector<double>& sorted) const
+{
+    Result result;
+    result.config = config;
+
+    TDigest td(config.delta, config.growthPCT);
+    std::vector<double> batch;
+    double start = threadTime();
+    if (config.batchSize) {
+        for (size_t i=0; i<trace.size(); i+=config.batchSize) {
+            batch.assign(trace.begin() + i, trace.begin() + std::min(i + config.batchSize, trace.size()));
+            std::sort(batch.begin(), batch.end());
+            td.merge(batch.begin(), batch.end());
+        }
+    }
+    else {
+        for (auto it=trace.begin(); it!=trace.end(); ++it) {
+            td.add(*it);
+        }
+    }
+    td.flush();
+    result.nsPerItem = (threadTime() - start)/trace.size();
+    result.bytes = td.bytes();
+
+    for (auto it=quantiles_.begin(); it!=quantiles_.end(); ++it) {
+        double value = td.quantile(*it);
+        // fraction of trace below estimated value, ties are counted by half
+        size_t below = std::lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin();
+        size_t upTo = std::upper_bound(sorted.begin(), sorted.end(), value) - sorted.begin();
+        double rank = (below + upTo)/2.0/sorted.size();
+        result.rankError = std::max(result.rankError, fabs(rank - *it));
+    }
+    result.withinBudget = (result.rankError <= rankErrorBudget_) && (result.bytes <= memoryBudget_);
+    return result;
+}
+
+std::vector<Tuner::Result> Tuner::sweep(const std::vector<double>& trace, size_t threads) const
+{
+    std::vector<Config> configs;
+    for (auto d=deltas_.begin(); d!=deltas_.end(); ++d) {
+        for (auto g=growths_.begin(); g!=growths_.end(); ++g) {
+            for (auto b=batchSizes_.begin(); b!=batchSizes_.end(); ++b) {
+                configs.push_back(Config(*d, *g, *b));
+            }
+        }
+    }
+    std::vector<Result> results(configs.size());
+    if (trace.empty()) {
+        return results;
+    }
+    std::vector<double> sorted(trace);
+    std::sort(sorted.begin(), sorted.end());
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i=next.fetch_add(1); i<configs.size(); i=next.fetch_add(1)) {
+            results[i] = run(configs[i], trace, sorted);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i=1; i<threads; ++i) {
+        pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto it=pool.begin(); it!=pool.end(); ++it) {
+        it->join();
+    }
+
+    // result is dominated if another one is not worse in error, memory and time and better in one of them
+    for (auto it=results.begin(); it!=results.end(); ++it) {
+        it->pareto = true;
+        for (auto other=results.begin(); other!=results.end(); ++other) {
+            bool notWorse = (other->rankError <= it->rankError) && (other->bytes <= it->bytes) && (other->nsPerItem <= it->nsPerItem);
+            bool better = (other->rankError < it->rankError) || (other->bytes < it->bytes) || (other->nsPerItem < it->nsPerItem);
+            if (notWorse && better) {
+                it->pareto = false;
+                break;
+            }
+        }
+    }
+    return results;
+}
+
+int Tuner::recommend(const std::vector<Tuner::Result>& results)
+{
+    int best = -1;
+    for (size_t i=0; i<results.size(); ++i) {
+        if (results[i].withinBudget && ((best < 0) || (results[i].nsPerItem < results[best].nsPerItem))) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        return best;
+    }
+    // budget is not reachable: the most accurate result
+    for (size_t i=0; i<results.size(); ++i) {
+        if ((best < 0) || (results[i].rankError < results[best].rankError)
+            || ((results[i].rankError == results[best].rankError) && (results[i].bytes < results[best].bytes))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+namespace rtstat
+{
+
+// Sweep of T-digest configurations (delta, excessive growth, clustering or merging of sorted batches)
+//    over a sample trace: measures rank error of target quantiles, memory and CPU time per item,
+//    recommends configuration within error and memory budget and builds Pareto frontier.
+class Tuner
+{
+    public:
+        class Config {
+            public:
+                Config(): delta(100), growthPCT(100), batchSize(0) {};
+                Config(size_t delta, size_t growthPCT, size_t batchSize): delta(delta), growthPCT(growthPCT), batchSize(batchSize) {};
+
+                size_t delta;
+                size_t growthPCT;
+                size_t batchSize; // 0 - clustering add(), otherwise merge() of sorted batches
+        };
+
+        class Result {
+            public:
+                Result(): rankError(0.0), bytes(0), nsPerItem(0.0), pareto(false), withinBudget(false) {};
+
+                Config config;
+                double rankError; // max |rank(estimated quantile) - q| over target quantiles
+                size_t bytes; // centroids buffers of T-digest after the trace, merge() spill buffer included
+                double nsPerItem; // CPU time of ingestion thread
+                bool pareto; // not dominated by error, memory and time of other result
+                bool withinBudget;
+        };
+
+        Tuner(std::vector<double> quantiles, double rankErrorBudget, size_t memoryBudget);
+
+        // configurations are product of deltas, growths and batch sizes, defaults cover common range
+        void setDeltas(const std::vector<size_t>& deltas) { deltas_ = deltas; };
+        void setGrowths(const std::vector<size_t>& growths) { growths_ = growths; };
+        void setBatchSizes(const std::vector<size_t>& batchSizes) { batchSizes_ = batchSizes; };
+
+        // run all configurations over trace in threads (0 - hardware concurrency), results are marked
+        //    as Pareto-optimal and within budget
+        std::vector<Result> sweep(const std::vector<double>& trace, size_t threads = 0) const;
+        // the fastest result within budget, otherwise the most accurate one,
+        //    return index in results or -1 if results are empty
+        static int recommend(const std::vector<Result>& results);
+
+    private:
+        Result run(const Config& config, const std::vector<double>& trace, const std::vector<double>& sorted) const;
+
+        std::vector<double> quantiles_;
+        double rankErrorBudget_;
+        size_t memoryBudget_;
+        std::vector<size_t> deltas_;
+        std::vector<size_t> growths_;
+        std::vector<size_t> batchSizes_;
+};
+
+} // namespace rtstat
@@ -0,0 +1,272 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include "exactquantiles.hpp"
+
+namespace rtstat {
+
+static const size_t RUN_BLOCK_SIZE = 4096; // values read at once from every run
+
+ExactQuantiles::ExactQuantiles(size_t chunkSize, size_t reservoirSize, const char* spillDir, size_t fanIn, uint64_t seed)
+    : chunkSize_(std::max(chunkSize, (size_t) 1)), reservoirSize_(reservoirSize), spillDir_(spillDir ? spillDir : ""), 
+    fanIn_(std::max(fanIn, (size_t) 2)), count_(0), failed_(false), random_(seed)
+{
+    buffer_.reserve(reservoirSize_ ? reservoirSize_ : chunkSize_);
+}
+
+void ExactQuantiles::clear()
+{
+    for (auto it=runs_.begin(); it!=runs_.end(); ++it) {
+        fclose(*it);
+    }
+    runs_.clear();
+    levels_.clear();
+    buffer_.clear();
+    count_ = 0;
+    failed_ = false;
+}
+
+bool ExactQuantiles::RunReader::next(double* value)
+{
+    if (position_ == size_) {
+        size_ = fread(block_.data(), sizeof(double), block_.size(), f_);
+        position_ = 0;
+        if (!size_) {
+            return false;
+        }
+    }
+    *value = block_[position_++];
+    return true;
+}
+
+// spill file is unlinked at once and removed by the system on close
+FILE* ExactQuantiles::createRun() const
+{
+    if (spillDir_.empty()) {
+        return tmpfile();
+    }
+    std::string path = spillDir_ + "/rtstat_exact_XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        return NULL;
+    }
+    unlink(path.c_str());
+    FILE* f = fdopen(fd, "w+b");
+    if (!f) {
+        close(fd);
+    }
+    return f;
+}
+
+void ExactQuantiles::add(double value)
+{
+    ++count_;
+    if (reservoirSize_) {
+        if (buffer_.size() < reservoirSize_) {
+            buffer_.push_back(value);
+        }
+        else {
+            uint64_t slot = std::uniform_int_distribution<uint64_t>(0, count_ - 1)(random_);
+            if (slot < reservoirSize_) {
+                buffer_[slot] = value;
+            }
+        }
+        return;
+    }
+    buffer_.push_back(value);
+    if ((buffer_.size() >= chunkSize_) && !failed_) { // after failed spill values are kept in memory
+        spill();
+    }
+}
+
+void ExactQuantiles::add(const double* values, size_t count)
+{
+    if (reservoirSize_) {
+        for (size_t i=0; i<count; ++i) {
+            add(values[i]);
+        }
+        return;
+    }
+    while (count) {
+        if (failed_) { // spill is not retried, rest is kept in memory
+            buffer_.insert(buffer_.end(), values, values + count);
+            count_ += count;
+            return;
+        }
+        size_t part = std::min(count, chunkSize_ - buffer_.size());
+        buffer_.insert(buffer_.end(), values, values + part);
+        count_ += part;
+        values += part;
+        count -= part;
+        if (buffer_.size() >= chunkSize_) {
+            spill();
+        }
+    }
+}
+
+class RunWriter { // visitor writing merged values into run
+    public:
+        explicit RunWriter(FILE* f): f_(f), ok_(true) { block_.reserve(RUN_BLOCK_SIZE); };
+
+        inline void operator()(double value) {
+            block_.push_back(value);
+            if (block_.size() == RUN_BLOCK_SIZE) {
+                flush();
+            }
+        };
+        bool flush() {
+            ok_ = ok_ && (fwrite(block_.data(), sizeof(double), block_.size(), f_) == block_.size());
+            block_.clear();
+            return ok_;
+        };
+    private:
+        FILE* f_;
+        std::vector<double> block_;
+        bool ok_;
+};
+
+class RankVisitor { // visitor picking values of ascending ranks
+    public:
+        RankVisitor(const uint64_t* ranks, double* result, size_t count): ranks_(ranks), result_(result), count_(count), index_(0), position_(0) {};
+
+        inline void operator()(double value) {
+            while ((index_ < count_) && (ranks_[index_] == position_)) {
+                result_[index_++] = value;
+            }
+            ++position_;
+        };
+    private:
+        const uint64_t* ranks_;
+        double* result_;
+        size_t count_;
+        size_t index_;
+        uint64_t position_;
+};
+
+// k-way merge of runs [first, last) and optionally sorted buffer into visitor
+template <class Visitor> bool ExactQuantiles::walk(size_t first, size_t last, bool withBuffer, Visitor& visitor)
+{
+    size_t runCount = last - first;
+    std::vector<RunReader> readers;
+    readers.reserve(runCount);
+    typedef std::pair<double, size_t> Head; // value, reader index (runCount - buffer)
+    std::vector<Head> heap;
+    for (size_t i=0; i<runCount; ++i) {
+        if (fseek(runs_[first + i], 0, SEEK_SET) != 0) {
+            return false;
+        }
+        readers.push_back(RunReader(runs_[first + i], RUN_BLOCK_SIZE));
+        double value;
+        if (readers.back().next(&value)) {
+            heap.push_back(Head(value, i));
+        }
+    }
+    size_t position = 0;
+    if (withBuffer && !buffer_.empty()) {
+        heap.push_back(Head(buffer_[position++], runCount));
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<Head>());
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Head>());
+        Head& head = heap.back();
+        visitor(head.first);
+        bool more = (head.second == runCount) ? (position < buffer_.size()) : readers[head.second].next(&head.first);
+        if (more) {
+            if (head.second == runCount) {
+                head.first = buffer_[position++];
+            }
+            std::push_heap(heap.begin(), heap.end(), std::greater<Head>());
+        }
+        else {
+            heap.pop_back();
+        }
+    }
+    return true;
+}
+
+void ExactQuantiles::spill()
+{
+    std::sort(buffer_.begin(), buffer_.end());
+    FILE* f = createRun();
+    if (!f || (fwrite(buffer_.data(), sizeof(double), buffer_.size(), f) != buffer_.size())) {
+        failed_ = true;
+        if (f) {
+            fclose(f);
+        }
+        return; // values are kept in memory
+    }
+    buffer_.clear();
+    runs_.push_back(f);
+
+    levels_.push_back(0);
+
+    // runs are merged by fan-in of the same level, so every value is rewritten log(count/chunk) times
+    while ((runs_.size() >= fanIn_) && (levels_[runs_.size() - fanIn_] == levels_.back())) {
+        size_t first = runs_.size() - fanIn_;
+        FILE* merged = createRun();
+        RunWriter writer(merged);
+        if (!merged || !walk(first, runs_.size(), false, writer) || !writer.flush()) {
+            if (merged) {
+                fclose(merged); // runs are kept as they are
+            }
+            return;
+        }
+        for (size_t i=first; i<runs_.size(); ++i) {
+            fclose(runs_[i]);
+        }
+        runs_.resize(first);
+        runs_.push_back(merged);
+        levels_.resize(first + 1);
+        ++levels_.back();
+    }
+}
+
+bool ExactQuantiles::quantiles(const double* q, double* result, size_t count)
+{
+    if (!count_) {
+        std::fill(result, result + count, 0.0);
+        return !failed_;
+    }
+    std::sort(buffer_.begin(), buffer_.end());
+    uint64_t size = reservoirSize_ ? buffer_.size() : count_;
+    std::vector<uint64_t> ranks(count);
+    for (size_t i=0; i<count; ++i) {
+        ranks[i] = std::min(static_cast<uint64_t>(size*q[i]), size - 1);
+    }
+    if (runs_.empty()) {
+        for (size_t i=0; i<count; ++i) {
+            result[i] = buffer_[ranks[i]];
+        }
+        return !failed_;
+    }
+    RankVisitor visitor(ranks.data(), result, count);
+    return walk(0, runs_.size(), true, visitor) && !failed_;
+}
+
+}
@@ -0,0 +1,93 @@
+/*
+
+Copyright (c) 2019 Denis Muratov <xeronm@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <random>
+
+namespace rtstat
+{
+
+// Ground truth quantiles of a stream for estimator verification in bounded memory.
+//    Exact mode buffers chunk of values, full chunk is sorted and spilled into temporary file as a run,
+//    fan-in runs of the same level are merged into a run of the next level. quantiles() walks all runs
+//    and the buffer with k-way heap in a single pass. Reservoir mode keeps uniform sample of the stream (algorithm R) instead.
+//    Quantile of rank floor(q*count) is returned, the same as set[set.size()*q] of sorted set.
+class ExactQuantiles
+{
+    public:
+        // reservoirSize = 0 - exact mode, spill files are created in spillDir or by tmpfile() if it is NULL
+        explicit ExactQuantiles(size_t chunkSize = 1 << 20, size_t reservoirSize = 0, const char* spillDir = NULL, size_t fanIn = 64, uint64_t seed = 1);
+        ~ExactQuantiles() { clear(); };
+
+        void add(double value);
+        void add(const double* values, size_t count);
+
+        // quantiles must be in ascending order, return false on spill I/O failure
+        bool quantiles(const double* q, double* result, size_t count);
+        void clear();
+
+        uint64_t count() const { return count_; };
+        size_t runs() const { return runs_.size(); }; // spilled runs
+        bool exact() const { return reservoirSize_ == 0; };
+        bool failed() const { return failed_; };
+
+    private:
+        class RunReader { // buffered reader of sorted run
+            public:
+                RunReader(FILE* f, size_t blockSize): f_(f), block_(blockSize), position_(0), size_(0) {};
+
+                bool next(double* value);
+            private:
+                FILE* f_;
+                std::vector<double> block_;
+                size_t position_;
+                size_t size_;
+        };
+
+        ExactQuantiles(const ExactQuantiles&);
+        ExactQuantiles& operator=(const ExactQuantiles&);
+
+        FILE* createRun() const;
+        void spill();
+        template <class Visitor> bool walk(size_t first, size_t last, bool withBuffer, Visitor& visitor);
+
+        size_t chunkSize_;
+        size_t reservoirSize_;
+        std::string spillDir_;
+        size_t fanIn_;
+        uint64_t count_;
+        bool failed_;
+        std::vector<double> buffer_; // unsorted chunk or reservoir
+        std::vector<FILE*> runs_;
+        std::vector<size_t> levels_; // merge level of every run
+        std::mt19937_64 random_;
+};
+
+} // namespace rtstat